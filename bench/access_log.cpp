@@ -0,0 +1,103 @@
+// Cost an io thread pays to log a request: writing the message header out as the
+// debug log did, formatting an access log line in place, and leaving a record in
+// the AccessLog ring for its thread to format.
+//
+//   http_bench_access_log [iterations] [threads]
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/beast/http.hpp>
+
+#include "http/access_log.hpp"
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+template<typename Function>
+void measure(char const* name, std::size_t threads, std::size_t iterations, Function&& function)
+{
+    std::vector<std::thread> workers;
+    auto start = Clock::now();
+    for(std::size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&]() {
+            for(std::size_t i = 0; i < iterations; ++i)
+                function(i);
+        });
+    }
+    for(auto& worker: workers)
+        worker.join();
+    auto elapsed = Clock::now() - start;
+
+    std::cout << name << "," << threads << ","
+              << double(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / double(iterations)
+              << std::endl;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    namespace beast = boost::beast;
+
+    std::size_t iterations = argc > 1 ? std::stoul(argv[1]) : 1000000;
+    std::size_t threads = argc > 2 ? std::stoul(argv[2]) : 2;
+
+    beast::http::response<beast::http::string_body> response{beast::http::status::ok, 11};
+    response.set(beast::http::field::server, "bench");
+    response.set(beast::http::field::content_type, "text/plain");
+    response.body() = "ok";
+    response.prepare_payload();
+
+    auto address = boost::asio::ip::make_address("127.0.0.1");
+    std::size_t written = 0;
+
+    // Discards the lines, the writer runs on the log thread either way
+    http::AccessLog::Options options;
+    options.capacity = 64 * 1024;
+    options.flushInterval = std::chrono::milliseconds(1);
+    auto log = std::make_unique<http::AccessLog>(
+        [&](std::string_view lines) { written += lines.size(); }, options);
+
+    std::cout << "logger,threads,ns_per_request\n";
+
+    for(std::size_t n: {std::size_t(1), threads}) {
+        measure("message_ostream", n, iterations, [&](std::size_t) {
+            std::ostringstream out;
+            out << response.base() << response.body();
+        });
+        measure("line_snprintf", n, iterations, [&](std::size_t i) {
+            char line[256];
+            std::snprintf(
+                line, sizeof(line), "%s - - [%s] \"%s %s HTTP/1.1\" %u %zu %zu\n",
+                address.to_string().c_str(), "17/Oct/2026:06:23:53 +0000", "GET", "/plaintext",
+                response.result_int(), std::size_t(120), i % 100);
+        });
+        measure("ring_push", n, iterations, [&](std::size_t i) {
+            http::AccessLog::Record record;
+            record.time = http::AccessLog::now();
+            record.method = uint16_t(beast::http::verb::get);
+            record.setTarget("/plaintext");
+            record.setAddress(address);
+            record.status = uint16_t(response.result_int());
+            record.bytes = 120;
+            record.duration = uint32_t(i % 100);
+            log->push(record);
+        });
+    }
+
+    // Drained on destruction, the lines written are counted after
+    auto stats = log->stats();
+    log.reset();
+    std::cout << "# ring dropped " << stats.dropped << ", wrote " << written << " bytes" << std::endl;
+
+    return written == 0;
+}
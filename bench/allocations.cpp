@@ -0,0 +1,125 @@
+// Heap allocations per request of a loopback Server with the copying
+// Request callback against the RequestView callback, with and without
+// the per-connection arena.
+//
+//   http_bench_allocations [requests] [body bytes]
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+
+#include "http/factory.hpp"
+
+namespace
+{
+
+std::atomic<uint64_t> allocations = 0;
+std::atomic<uint64_t> allocated = 0;
+
+}
+
+void* operator new(std::size_t size)
+{
+    ++allocations;
+    allocated += size;
+
+    if(void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace
+{
+
+void measure(
+    http::Factory& factory,
+    std::string_view name,
+    uint16_t port,
+    std::size_t requests,
+    std::string const& body,
+    std::function<void(http::Server&)> setup)
+{
+    auto server = factory.getServer("127.0.0.1", port);
+    setup(*server);
+    server->run();
+
+    auto client = factory.getClient("127.0.0.1", port);
+
+    http::Request request;
+    request.target = "/bench";
+    request.fields["content-type"] = "application/json";
+    request.fields["x-request-id"] = "0123456789abcdef";
+    request.body = body;
+
+    std::string response;
+    client->post(request, response);
+
+    uint64_t count = allocations;
+    uint64_t bytes = allocated;
+
+    for(std::size_t i = 0; i < requests; ++i)
+        client->post(request, response);
+
+    // Client and server share the process, the client side is the same for both callbacks
+    std::cout
+        << name << ": "
+        << double(allocations - count) / requests << " allocations, "
+        << double(allocated - bytes) / requests << " bytes per request\n";
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    std::size_t requests = argc > 1 ? std::stoul(argv[1]) : 10000;
+    std::size_t size = argc > 2 ? std::stoul(argv[2]) : 100 * 1024;
+
+    std::string body(size, 'x');
+
+    http::Factory factory({1, false, false});
+
+    measure(factory, "Request copy", 18101, requests, body, [](http::Server& server) {
+        server.setCallback([](http::Request const& request) {
+            http::Response response;
+            response.body = std::to_string(request.body.size());
+            return response;
+        });
+    });
+
+    auto view = [](http::RequestView const& request) {
+        http::Response response;
+        response.body = std::to_string(request.body().size());
+        return response;
+    };
+
+    measure(factory, "RequestView, heap", 18102, requests, body, [&](http::Server& server) {
+        http::Server::Options options;
+        options.arenaSize = 0;
+        server.setOptions(options);
+        server.setViewCallback(view);
+    });
+
+    measure(factory, "RequestView, arena", 18103, requests, body, [&](http::Server& server) {
+        server.setViewCallback(view);
+    });
+
+    auto stats = http::Server::getAllocatorStats();
+    std::cout
+        << "arena: " << stats.arenaAllocations << " allocations, " << stats.arenaBytes << " bytes\n"
+        << "fallback: " << stats.fallbackAllocations << " allocations, " << stats.fallbackBytes << " bytes\n"
+        << "recycled: " << stats.recycled << ", fresh: " << stats.fresh << "\n";
+
+    return 0;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+
+namespace bench
+{
+
+// Command line of --name=value options, a bare --name counts as true
+class Arguments
+{
+public:
+    Arguments(int argc, char** argv)
+    {
+        for(int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if(arg.compare(0, 2, "--") != 0) {
+                std::cerr << "Ignored argument " << arg << "\n";
+                continue;
+            }
+
+            auto equal = arg.find('=');
+            if(equal == std::string::npos)
+                _values[arg.substr(2)] = "1";
+            else
+                _values[arg.substr(2, equal - 2)] = arg.substr(equal + 1);
+        }
+    }
+
+    bool has(std::string const& name) const
+    {
+        return _values.count(name) != 0;
+    }
+
+    std::string get(std::string const& name, std::string const& fallback) const
+    {
+        auto it = _values.find(name);
+        return it == _values.end() ? fallback : it->second;
+    }
+
+    uint64_t get(std::string const& name, uint64_t fallback) const
+    {
+        auto it = _values.find(name);
+        return it == _values.end() ? fallback : std::stoull(it->second);
+    }
+
+    bool flag(std::string const& name) const
+    {
+        auto value = get(name, std::string("0"));
+        return value != "0" && value != "false" && value != "off";
+    }
+
+private:
+    std::map<std::string, std::string> _values;
+};
+
+inline std::string readFile(std::string const& path)
+{
+    std::ifstream file(path);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+}
@@ -0,0 +1,118 @@
+// Fanning one incoming request out to a number of upstream calls. A loopback Server
+// stands in for the upstreams and answers each call after a few milliseconds, the
+// calls go once one after another over a Client and once at the same time through
+// a BatchClient, with and without a quorum.
+//
+//   http_bench_batch [calls] [rounds] [quorum]
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "http/factory.hpp"
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+template<typename Function>
+void measure(char const* name, std::size_t calls, std::size_t rounds, Function&& function)
+{
+    // One round first to open the connections
+    function();
+
+    std::size_t failed = 0;
+    auto start = Clock::now();
+    for(std::size_t i = 0; i < rounds; ++i)
+        failed += function();
+    auto elapsed = Clock::now() - start;
+
+    std::cout << name << "," << calls << ","
+              << double(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()) / 1000.0 / double(rounds)
+              << "," << failed << std::endl;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    std::size_t calls = argc > 1 ? std::stoul(argv[1]) : 32;
+    std::size_t rounds = argc > 2 ? std::stoul(argv[2]) : 20;
+    std::size_t quorum = argc > 3 ? std::stoul(argv[3]) : calls / 2;
+
+    http::Factory factory({2, true, false});
+
+    uint16_t port = 18110;
+    auto server = factory.getServer("127.0.0.1", port);
+
+    http::Server::Options options;
+    options.maxRequests = 0;
+    server->setOptions(options);
+
+    // Upstreams answer after the milliseconds the call asks for, from a timer thread
+    boost::asio::io_context timers;
+    auto work = boost::asio::make_work_guard(timers);
+    std::thread timerThread([&timers]() { timers.run(); });
+
+    server->setAsyncCallback([&timers](http::Request const& request, http::Server::Responder responder) {
+        auto delay = std::chrono::milliseconds(std::stoul(std::string(request.params.get("ms"))));
+        auto timer = std::make_shared<boost::asio::steady_timer>(timers, delay);
+        timer->async_wait([timer, responder](boost::beast::error_code) {
+            http::Response response;
+            response.body = "ok";
+            responder.send(std::move(response));
+        });
+    });
+
+    if(!server->run())
+        return 1;
+
+    // Latencies of 2 to 9 ms, as a mix of upstreams would have
+    std::vector<http::BatchClient::Call> batch(calls);
+    for(std::size_t i = 0; i < calls; ++i) {
+        batch[i].port = port;
+        batch[i].request.target = "/upstream";
+        batch[i].request.params["ms"] = std::to_string(2 + i % 8);
+    }
+
+    std::cout << "mode,calls,ms_per_fan_out,failed\n";
+
+    auto client = factory.getClient("127.0.0.1", port);
+    measure("sequential", calls, rounds, [&]() {
+        std::size_t failed = 0;
+        for(auto const& call: batch) {
+            std::string body;
+            failed += !client->get(call.request, body);
+        }
+        return failed;
+    });
+
+    http::BatchClient::Options batchOptions;
+    batchOptions.maxPerHost = calls;
+    auto all = factory.getBatchClient(batchOptions);
+    measure("batch", calls, rounds, [&]() {
+        std::size_t failed = 0;
+        for(auto const& result: all->run(batch))
+            failed += bool(result.error);
+        return failed;
+    });
+
+    // Calls beyond the quorum are aborted, they are not counted as failed
+    batchOptions.quorum = quorum;
+    auto first = factory.getBatchClient(batchOptions);
+    measure("batch_quorum", calls, rounds, [&]() {
+        std::size_t failed = 0;
+        for(auto const& result: first->run(batch))
+            failed += result.error && result.error != boost::asio::error::operation_aborted;
+        return failed;
+    });
+
+    work.reset();
+    timers.stop();
+    timerThread.join();
+
+    return 0;
+}
@@ -0,0 +1,98 @@
+// CPU time against bytes on the wire of gzip at different levels, for a JSON
+// body like the ones our services return.
+//
+//   http_bench_compression [body bytes] [iterations]
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "http/compression.hpp"
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+std::string makeBody(std::size_t size)
+{
+    std::string body = "[";
+    for(std::size_t i = 0; body.size() < size; ++i) {
+        body += "{\"id\":" + std::to_string(i)
+            + ",\"name\":\"item-" + std::to_string(i * 7919 % 1000)
+            + "\",\"price\":" + std::to_string(i * 31 % 10000) + "." + std::to_string(i % 100)
+            + ",\"tags\":[\"a\",\"b\"],\"active\":" + (i % 3 ? "true" : "false") + "},";
+    }
+    body.back() = ']';
+    return body;
+}
+
+template<typename Function>
+double measure(std::size_t iterations, Function function)
+{
+    auto start = Clock::now();
+    for(std::size_t i = 0; i < iterations; ++i)
+        function();
+    std::chrono::duration<double, std::micro> elapsed = Clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    std::size_t size = argc > 1 ? std::stoul(argv[1]) : 64 * 1024;
+    std::size_t iterations = argc > 2 ? std::stoul(argv[2]) : 200;
+
+    auto body = makeBody(size);
+
+    std::cout
+        << "body " << body.size() << " bytes\n"
+        << std::setw(6) << "level"
+        << std::setw(12) << "bytes"
+        << std::setw(8) << "ratio"
+        << std::setw(14) << "compress us"
+        << std::setw(10) << "MB/s"
+        << std::setw(16) << "decompress us" << "\n";
+
+    for(int level: {1, 3, 6, 9}) {
+        std::string compressed;
+        double compress = measure(iterations, [&] {
+            http::compress(body, http::Encoding::gzip, level, compressed);
+        });
+
+        std::string decompressed;
+        double decompress = measure(iterations, [&] {
+            http::decompress(compressed, http::Encoding::gzip, body.size(), decompressed);
+        });
+
+        if(decompressed != body) {
+            std::cerr << "level " << level << ": round trip failed\n";
+            return 1;
+        }
+
+        std::cout << std::fixed << std::setprecision(1)
+            << std::setw(6) << level
+            << std::setw(12) << compressed.size()
+            << std::setw(8) << double(body.size()) / compressed.size()
+            << std::setw(14) << compress
+            << std::setw(10) << body.size() / compress
+            << std::setw(16) << decompress << "\n";
+    }
+
+    // A cached body of a static response costs a lookup instead of a compression
+    http::CompressionCache cache;
+    std::string compressed;
+    http::compress(body, http::Encoding::gzip, 6, compressed);
+    cache.store("/static/page.html", "\"v1\"", http::Encoding::gzip, 6, body.size(), std::make_shared<std::string const>(compressed));
+
+    double hit = measure(iterations * 100, [&] {
+        auto cached = cache.get("/static/page.html", "\"v1\"", http::Encoding::gzip, 6, body.size());
+        std::string copy(*cached);
+    });
+    std::cout << "cache hit with copy: " << hit << " us\n";
+
+    return 0;
+}
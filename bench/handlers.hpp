@@ -0,0 +1,75 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <string>
+
+#include "http/server.hpp"
+
+#include "arguments.hpp"
+
+namespace bench
+{
+
+// Installs the callbacks of one kind of handler on the server. A new handler is
+// a new entry in handlers(), the load generator does not need to know about it
+using Handler = std::function<void(http::Server& server, Arguments const& args)>;
+
+inline std::map<std::string, Handler> const& handlers()
+{
+    static std::map<std::string, Handler> const handlers = {
+        // --response-bytes of body built once, copied into every response
+        {"fixed", [](http::Server& server, Arguments const& args) {
+            auto body = std::make_shared<std::string const>(args.get("response-bytes", uint64_t(2)), 'x');
+            server.setCallback([body](http::Request const&) {
+                http::Response response;
+                response.body = *body;
+                return response;
+            });
+        }},
+        // The request body is sent back
+        {"echo", [](http::Server& server, Arguments const&) {
+            server.setCallback([](http::Request const& request) {
+                http::Response response;
+                response.body = request.body;
+                return response;
+            });
+        }},
+        // Same as fixed through the RequestView callback, without the copy of the request
+        {"view", [](http::Server& server, Arguments const& args) {
+            auto body = std::make_shared<std::string const>(args.get("response-bytes", uint64_t(2)), 'x');
+            server.setViewCallback([body](http::RequestView const&) {
+                http::Response response;
+                response.body = *body;
+                return response;
+            });
+        }},
+        // --file is served with sendfile, or through the chunk buffer over TLS
+        {"file", [](http::Server& server, Arguments const& args) {
+            auto path = args.get("file", std::string());
+            server.setCallback([path](http::Request const&) {
+                http::Response response;
+                response.file = path;
+                return response;
+            });
+        }},
+        // Answers after --delay-ms from a timer thread, the io threads stay free meanwhile
+        {"async", [](http::Server& server, Arguments const& args) {
+            auto body = std::make_shared<std::string const>(args.get("response-bytes", uint64_t(2)), 'x');
+            auto delay = std::chrono::milliseconds(args.get("delay-ms", uint64_t(1)));
+            auto timers = std::make_shared<boost::asio::thread_pool>(1);
+            server.setAsyncCallback([body, delay, timers](http::Request const&, http::Server::Responder responder) {
+                auto timer = std::make_shared<boost::asio::steady_timer>(timers->get_executor(), delay);
+                timer->async_wait([body, timer, responder](boost::beast::error_code) {
+                    http::Response response;
+                    response.body = *body;
+                    responder.send(std::move(response));
+                });
+            });
+        }},
+    };
+
+    return handlers;
+}
+
+}
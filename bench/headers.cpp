@@ -0,0 +1,92 @@
+// Building, looking up and iterating the fields of a typical request with
+// the flat HeaderMap against the std::map it replaced.
+//
+//   http_bench_headers [iterations]
+
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "http/message.hpp"
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+std::vector<std::pair<std::string, std::string>> const fields = {
+    {"host", "api.example.com"},
+    {"user-agent", "Mozilla/5.0 (X11; Linux x86_64)"},
+    {"accept", "application/json"},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", "en-US,en;q=0.9"},
+    {"connection", "keep-alive"},
+    {"content-type", "application/json"},
+    {"content-length", "128"},
+    {"authorization", "Bearer 0123456789abcdef"},
+    {"x-request-id", "5f2b7c1e-8a34-4d6e-9b0f-1c2d3e4f5a6b"},
+    {"x-forwarded-for", "10.0.0.1"},
+    {"cache-control", "no-cache"},
+};
+
+std::vector<std::string> const lookups = {
+    "content-type", "Content-Length", "authorization", "x-request-id", "if-none-match",
+};
+
+// Keeps the optimizer from dropping the work
+std::size_t sink = 0;
+
+template<typename Map, typename Find>
+void measure(std::string_view name, std::size_t iterations, Find find)
+{
+    auto start = Clock::now();
+
+    for(std::size_t i = 0; i < iterations; ++i) {
+        Map map;
+        for(auto& [key, value]: fields)
+            map[key] = value;
+
+        for(std::size_t k = 0; k < lookups.size(); ++k)
+            sink += find(map, k);
+
+        for(auto& [key, value]: map)
+            sink += key.size() + value.size();
+    }
+
+    std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+    std::cout << name << ": " << elapsed.count() / iterations << " ns per request\n";
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    std::size_t iterations = argc > 1 ? std::stoul(argv[1]) : 1000000;
+
+    // The map needs its keys lowercased first, as the server did before
+    measure<std::map<std::string, std::string>>("std::map", iterations, [](auto& map, std::size_t k) {
+        auto key = lookups[k];
+        for(auto& c: key)
+            c = std::tolower(c);
+        auto it = map.find(key);
+        return it == map.end() ? 0 : it->second.size();
+    });
+
+    measure<http::HeaderMap>("HeaderMap", iterations, [](auto& map, std::size_t k) {
+        return map.get(lookups[k]).size();
+    });
+
+    // Names the caller already knows as fields, the lookup compares no strings
+    std::vector<boost::beast::http::field> known;
+    for(auto& key: lookups)
+        known.push_back(boost::beast::http::string_to_field(key));
+
+    measure<http::HeaderMap>("HeaderMap by field", iterations, [&](auto& map, std::size_t k) {
+        return map.get(known[k]).size();
+    });
+
+    return sink == 0;
+}
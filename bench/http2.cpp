@@ -0,0 +1,117 @@
+// Requests per second of a loopback Server with the same number of requests in flight,
+// once over HTTP/1.1 with a connection per request and once multiplexed over HTTP/2.
+//
+//   http_bench_http2 [seconds] [requests in flight] [connections for HTTP/2]
+
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "http/factory.hpp"
+
+namespace
+{
+
+template<typename ClientType>
+class Worker
+    : public std::enable_shared_from_this<Worker<ClientType>>
+{
+public:
+    Worker(std::shared_ptr<ClientType> client, std::atomic<bool>& stop, std::atomic<uint64_t>& done)
+        : _client(std::move(client))
+        , _stop(stop)
+        , _done(done)
+    {}
+
+    void run()
+    {
+        if(_stop)
+            return;
+
+        _client->async_get(
+            _request,
+            [self = this->shared_from_this()](boost::beast::error_code ec, std::string) {
+                if(!ec)
+                    ++self->_done;
+                self->run();
+            });
+    }
+
+private:
+    std::shared_ptr<ClientType>     _client;
+    std::atomic<bool>&              _stop;
+    std::atomic<uint64_t>&          _done;
+    http::Request                   _request = {"/bench", {}, {}, {}};
+};
+
+// Every worker keeps one request in flight on the client it is given
+template<typename ClientType>
+double measure(std::vector<std::shared_ptr<ClientType>> const& clients, std::size_t inFlight, std::chrono::seconds duration)
+{
+    std::atomic<bool> stop = false;
+    std::atomic<uint64_t> done = 0;
+
+    for(std::size_t i = 0; i < inFlight; ++i)
+        std::make_shared<Worker<ClientType>>(clients[i % clients.size()], stop, done)->run();
+
+    // Skip connection setup before measuring
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    uint64_t start = done;
+    std::this_thread::sleep_for(duration);
+    uint64_t count = done - start;
+
+    stop = true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    return double(count) / duration.count();
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    auto duration = std::chrono::seconds(argc > 1 ? std::stoul(argv[1]) : 5);
+    std::size_t inFlight = argc > 2 ? std::stoul(argv[2]) : 64;
+    std::size_t connections = argc > 3 ? std::stoul(argv[3]) : 1;
+
+    http::Factory factory({2, true, false});
+    http::Factory client({2, true, false});
+
+    uint16_t port = 18100;
+    auto server = factory.getServer("127.0.0.1", port);
+
+    http::Server::Options options;
+    options.http2 = true;
+    options.maxRequests = 0;
+    options.maxStreams = uint32_t(inFlight);
+    server->setOptions(options);
+
+    server->setCallback([](http::Request const&) {
+        http::Response response;
+        response.body = "ok";
+        return response;
+    });
+
+    if(!server->run())
+        return 1;
+
+    std::cout << "protocol,connections,in_flight,requests_per_second\n";
+
+    std::vector<std::shared_ptr<http::Client>> http1;
+    for(std::size_t i = 0; i < inFlight; ++i)
+        http1.push_back(client.getClient("127.0.0.1", port));
+
+    std::cout << "http/1.1," << http1.size() << "," << inFlight << ","
+              << measure(http1, inFlight, duration) << std::endl;
+
+    std::vector<std::shared_ptr<http::Http2Client>> http2;
+    for(std::size_t i = 0; i < std::max<std::size_t>(connections, 1); ++i)
+        http2.push_back(client.getHttp2Client("127.0.0.1", port));
+
+    std::cout << "h2c," << http2.size() << "," << inFlight << ","
+              << measure(http2, inFlight, duration) << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,246 @@
+// Load generator for a Server such as http_bench_server, printing throughput and latency percentiles.
+//
+//   http_bench [--host=127.0.0.1] [--port=18400] [--protocol=http|https|h2c|h2] [--target=/bench]
+//              [--connections=N] [--concurrency=64] [--reuse=1] [--request-bytes=0]
+//              [--rate=0] [--duration=10] [--warmup=2] [--threads=2] [--ca=cert.pem] [--header]
+//              [--phases]
+//
+// Closed loop by default: every one of --concurrency callers sends its next request once
+// the previous one is answered. With --rate the requests go out on a fixed schedule instead,
+// whatever the server does, and latency counts from the time a request was due, so a
+// stalled server shows up in the percentiles instead of only slowing the generator down.
+//
+// --connections defaults to --concurrency for HTTP/1.1 and to 1 for HTTP/2, --reuse=0 asks
+// the server to close every HTTP/1.1 connection after its response. A --request-bytes body
+// turns the requests into POSTs. --phases writes the time HTTP/1.1 clients spent in every
+// phase of a request to stderr, in the Prometheus text format.
+
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "http/factory.hpp"
+
+#include "arguments.hpp"
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+struct Settings
+{
+    std::string             protocol;
+    std::size_t             connections = 0;
+    std::size_t             concurrency = 0;
+    bool                    reuse = true;
+    std::size_t             requestBytes = 0;
+    uint64_t                rate = 0;
+    std::chrono::seconds    duration;
+    std::chrono::seconds    warmup;
+    http::Request           request;
+};
+
+struct Results
+{
+    http::Histogram         latency;
+    std::atomic<uint64_t>   done = 0;
+    std::atomic<uint64_t>   errors = 0;
+    std::atomic<uint64_t>   inFlight = 0;
+    std::atomic<bool>       measuring = false;
+    std::atomic<bool>       stop = false;
+
+    // Latency in microseconds, counted only inside the measured window
+    void complete(Clock::time_point start, bool ok)
+    {
+        if(measuring) {
+            if(ok) {
+                ++done;
+                latency.record(uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count()));
+            }
+            else {
+                ++errors;
+            }
+        }
+        --inFlight;
+    }
+};
+
+template<typename ClientType>
+void send(ClientType& client, Settings const& settings, Results& results, Clock::time_point start, std::function<void()> next)
+{
+    ++results.inFlight;
+
+    auto handler = [&results, start, next = std::move(next)](boost::beast::error_code ec, std::string) {
+        results.complete(start, !ec);
+        if(next)
+            next();
+    };
+
+    if(settings.requestBytes)
+        client.async_post(settings.request, std::move(handler));
+    else
+        client.async_get(settings.request, std::move(handler));
+}
+
+// Keeps one request in flight on its client until stopped
+template<typename ClientType>
+class Caller
+    : public std::enable_shared_from_this<Caller<ClientType>>
+{
+public:
+    Caller(std::shared_ptr<ClientType> client, Settings const& settings, Results& results)
+        : _client(std::move(client))
+        , _settings(settings)
+        , _results(results)
+    {}
+
+    void run()
+    {
+        if(_results.stop)
+            return;
+
+        send(*_client, _settings, _results, Clock::now(), [self = this->shared_from_this()]() { self->run(); });
+    }
+
+private:
+    std::shared_ptr<ClientType>     _client;
+    Settings const&                 _settings;
+    Results&                        _results;
+};
+
+template<typename ClientType>
+void closedLoop(std::vector<std::shared_ptr<ClientType>> const& clients, Settings const& settings, Results& results)
+{
+    for(std::size_t i = 0; i < settings.concurrency; ++i)
+        std::make_shared<Caller<ClientType>>(clients[i % clients.size()], settings, results)->run();
+}
+
+// Sends rate requests per second on schedule from its own thread until stopped
+template<typename ClientType>
+std::thread openLoop(std::vector<std::shared_ptr<ClientType>> const& clients, Settings const& settings, Results& results)
+{
+    return std::thread([&clients, &settings, &results]() {
+        auto interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / double(settings.rate)));
+        auto due = Clock::now();
+
+        for(std::size_t i = 0; !results.stop; ++i) {
+            std::this_thread::sleep_until(due);
+            send(*clients[i % clients.size()], settings, results, due, nullptr);
+            due += interval;
+        }
+    });
+}
+
+template<typename ClientType>
+void run(std::vector<std::shared_ptr<ClientType>> const& clients, Settings const& settings, Results& results)
+{
+    std::thread pacer;
+    if(settings.rate)
+        pacer = openLoop(clients, settings, results);
+    else
+        closedLoop(clients, settings, results);
+
+    std::this_thread::sleep_for(settings.warmup);
+    results.measuring = true;
+    std::this_thread::sleep_for(settings.duration);
+    results.measuring = false;
+    results.stop = true;
+
+    if(pacer.joinable())
+        pacer.join();
+
+    // Requests still out finish before the clients go away
+    auto deadline = Clock::now() + std::chrono::seconds(10);
+    while(results.inFlight && Clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+}
+
+template<typename ClientType, typename Create>
+void prepare(Settings const& settings, Results& results, Create&& create)
+{
+    std::vector<std::shared_ptr<ClientType>> clients;
+    for(std::size_t i = 0; i < settings.connections; ++i)
+        clients.push_back(create());
+
+    run(clients, settings, results);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    bench::Arguments args(argc, argv);
+
+    Settings settings;
+    settings.protocol = args.get("protocol", std::string("http"));
+    settings.concurrency = std::max<uint64_t>(args.get("concurrency", uint64_t(64)), 1);
+    bool http2 = settings.protocol == "h2c" || settings.protocol == "h2";
+    settings.connections = std::max<uint64_t>(args.get("connections", uint64_t(http2 ? 1 : settings.concurrency)), 1);
+    settings.reuse = args.get("reuse", std::string("1")) != "0";
+    settings.requestBytes = args.get("request-bytes", uint64_t(0));
+    settings.rate = args.get("rate", uint64_t(0));
+    settings.duration = std::chrono::seconds(args.get("duration", uint64_t(10)));
+    settings.warmup = std::chrono::seconds(args.get("warmup", uint64_t(2)));
+
+    settings.request.target = args.get("target", std::string("/bench"));
+    settings.request.body = std::string(settings.requestBytes, 'x');
+    // HTTP/2 has no connection header, a connection there always carries many requests
+    if(!settings.reuse)
+        settings.request.fields["connection"] = "close";
+
+    auto host = args.get("host", std::string("127.0.0.1"));
+    auto port = uint16_t(args.get("port", uint64_t(18400)));
+
+    http::Factory factory({args.get("threads", uint64_t(2)), true, false});
+    if(args.has("ca") && !factory.addCertificate(bench::readFile(args.get("ca", std::string()))))
+        return 1;
+
+    auto phases = std::make_shared<http::ClientMetrics>();
+    if(args.flag("phases"))
+        factory.setMetrics(phases);
+
+    Results results;
+
+    if(settings.protocol == "http")
+        prepare<http::Client>(settings, results, [&]() { return factory.getClient(host, port); });
+    else if(settings.protocol == "https")
+        prepare<http::SslClient>(settings, results, [&]() { return factory.getSslClient(host, port); });
+    else if(settings.protocol == "h2c")
+        prepare<http::Http2Client>(settings, results, [&]() { return factory.getHttp2Client(host, port); });
+    else if(settings.protocol == "h2")
+        prepare<http::Http2Client>(settings, results, [&]() { return factory.getHttp2SslClient(host, port); });
+    else {
+        std::cerr << "Unknown protocol " << settings.protocol << ", one of: http https h2c h2\n";
+        return 1;
+    }
+
+    auto latency = results.latency.snapshot();
+    double seconds = double(settings.duration.count());
+
+    if(args.flag("header"))
+        std::cout << "protocol,mode,connections,concurrency,rate,reuse,request_bytes,"
+                     "requests,errors,requests_per_second,p50_us,p99_us,p999_us,max_us\n";
+
+    std::cout << settings.protocol << ","
+              << (settings.rate ? "open" : "closed") << ","
+              << settings.connections << ","
+              << (settings.rate ? 0 : settings.concurrency) << ","
+              << settings.rate << ","
+              << settings.reuse << ","
+              << settings.requestBytes << ","
+              << results.done << ","
+              << results.errors << ","
+              << double(results.done) / seconds << ","
+              << latency.percentile(0.5) << ","
+              << latency.percentile(0.99) << ","
+              << latency.percentile(0.999) << ","
+              << latency.max << std::endl;
+
+    if(args.flag("phases"))
+        std::cerr << phases->prometheus();
+
+    return 0;
+}
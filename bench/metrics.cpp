@@ -0,0 +1,72 @@
+// Cost of recording into the metrics from several threads at once: the sharded
+// Counter and Histogram against a single shared atomic, which every thread
+// would otherwise keep pulling into its own cache.
+//
+//   http_bench_metrics [iterations] [threads]
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "http/metrics.hpp"
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+template<typename Function>
+void measure(char const* name, std::size_t threads, std::size_t iterations, Function&& function)
+{
+    std::vector<std::thread> workers;
+    auto start = Clock::now();
+    for(std::size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            for(std::size_t i = 0; i < iterations; ++i)
+                function(t, i);
+        });
+    }
+    for(auto& worker: workers)
+        worker.join();
+    auto elapsed = Clock::now() - start;
+
+    std::cout << name << "," << threads << ","
+              << double(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / double(iterations)
+              << std::endl;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    std::size_t iterations = argc > 1 ? std::stoul(argv[1]) : 10000000;
+    std::size_t threads = argc > 2 ? std::stoul(argv[2]) : 4;
+
+    http::Counter counter;
+    http::Histogram histogram;
+    std::atomic<uint64_t> shared = 0;
+
+    std::cout << "instrument,threads,ns_per_record\n";
+
+    for(std::size_t n: {std::size_t(1), threads}) {
+        measure("shared_atomic", n, iterations, [&](std::size_t, std::size_t) {
+            shared.fetch_add(1, std::memory_order_relaxed);
+        });
+        measure("counter", n, iterations, [&](std::size_t, std::size_t) {
+            counter.add();
+        });
+        // Latencies of a few tens of microseconds, as a loopback request takes
+        measure("histogram", n, iterations, [&](std::size_t t, std::size_t i) {
+            histogram.record(20 + (i + t) % 64);
+        });
+        measure("histogram_timed", n, iterations / 10, [&](std::size_t, std::size_t) {
+            histogram.record(http::metrics::Clock::now());
+        });
+    }
+
+    // Keeps the loops from being optimized away
+    return counter.value() + shared == 0;
+}
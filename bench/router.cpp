@@ -0,0 +1,154 @@
+// Matching requests against a table of a few hundred routes with the compiled
+// Router against a scan of the patterns in order, as a callback full of
+// if/else on the target would do. Heap allocations are counted for the Router.
+//
+//   http_bench_router [iterations]
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "http/router.hpp"
+
+namespace
+{
+
+std::atomic<uint64_t> allocations = 0;
+
+}
+
+void* operator new(std::size_t size)
+{
+    ++allocations;
+
+    if(void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+struct Pattern
+{
+    boost::beast::http::verb    method;
+    std::string                 path;
+};
+
+// Compares segment by segment, a ":" segment matches any non-empty one
+bool matches(std::string_view pattern, std::string_view path)
+{
+    while(!pattern.empty() && !path.empty()) {
+        auto patternEnd = pattern.find('/', 1);
+        auto pathEnd = path.find('/', 1);
+        auto segment = pattern.substr(0, patternEnd);
+        auto value = path.substr(0, pathEnd);
+
+        if(segment.size() > 1 && segment[1] == '*')
+            return true;
+        if(!(segment.size() > 1 && segment[1] == ':' && value.size() > 1) && segment != value)
+            return false;
+
+        pattern.remove_prefix(segment.size());
+        path.remove_prefix(value.size());
+    }
+
+    return pattern.empty() && path.empty();
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    using boost::beast::http::verb;
+
+    std::size_t iterations = argc > 1 ? std::stoul(argv[1]) : 1000000;
+
+    // 30 resources with 8 routes each and a static file tree
+    std::vector<Pattern> patterns;
+    for(int i = 0; i < 30; ++i) {
+        std::string base = "/api/v1/resource" + std::to_string(i);
+        patterns.push_back({verb::get, base});
+        patterns.push_back({verb::post, base});
+        patterns.push_back({verb::get, base + "/:id"});
+        patterns.push_back({verb::put, base + "/:id"});
+        patterns.push_back({verb::delete_, base + "/:id"});
+        patterns.push_back({verb::get, base + "/:id/items"});
+        patterns.push_back({verb::get, base + "/:id/items/:item"});
+        patterns.push_back({verb::post, base + "/:id/items"});
+    }
+    patterns.push_back({verb::get, "/static/*path"});
+
+    http::Router router;
+    for(auto const& pattern: patterns) {
+        router.add(pattern.method, pattern.path, [](http::RequestView const&, http::Captures const&) {
+            return http::Response();
+        });
+    }
+    router.compile();
+
+    std::vector<std::pair<verb, std::string>> requests;
+    for(int i = 0; i < 30; i += 3) {
+        std::string base = "/api/v1/resource" + std::to_string(i);
+        requests.emplace_back(verb::get, base);
+        requests.emplace_back(verb::get, base + "/12345");
+        requests.emplace_back(verb::delete_, base + "/12345");
+        requests.emplace_back(verb::get, base + "/12345/items/67?expand=1");
+    }
+    requests.emplace_back(verb::get, "/static/css/site.css");
+    requests.emplace_back(verb::get, "/missing/path");
+
+    std::cout << "matcher,routes,ns_per_match,allocations_per_match\n";
+
+    std::size_t found = 0;
+
+    allocations = 0;
+    auto start = Clock::now();
+    for(std::size_t i = 0; i < iterations; ++i) {
+        auto const& [method, target] = requests[i % requests.size()];
+        found += router.match(method, target).handler != nullptr;
+    }
+    auto elapsed = Clock::now() - start;
+    uint64_t allocated = allocations;
+
+    std::cout << "router," << patterns.size() << ","
+              << double(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / double(iterations) << ","
+              << double(allocated) / double(iterations) << std::endl;
+
+    start = Clock::now();
+    for(std::size_t i = 0; i < iterations; ++i) {
+        auto const& [method, target] = requests[i % requests.size()];
+        std::string_view path(target);
+        path = path.substr(0, path.find('?'));
+        for(auto const& pattern: patterns) {
+            if(pattern.method == method && matches(pattern.path, path)) {
+                ++found;
+                break;
+            }
+        }
+    }
+    elapsed = Clock::now() - start;
+
+    std::cout << "linear," << patterns.size() << ","
+              << double(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / double(iterations) << ","
+              << 0 << std::endl;
+
+    // Keeps the loops from being optimized away
+    return found == 0;
+}
@@ -0,0 +1,93 @@
+// Requests per second of a loopback Server as its thread count grows from 1 to N.
+//
+//   http_bench_scaling [max threads] [shared|reactor] [seconds per step] [connections]
+
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "http/factory.hpp"
+
+namespace
+{
+
+class Worker
+    : public std::enable_shared_from_this<Worker>
+{
+public:
+    Worker(std::shared_ptr<http::Client> client, std::atomic<bool>& stop, std::atomic<uint64_t>& done)
+        : _client(std::move(client))
+        , _stop(stop)
+        , _done(done)
+    {}
+
+    void run()
+    {
+        if(_stop)
+            return;
+
+        _client->async_get(
+            _request,
+            [self = shared_from_this()](boost::beast::error_code ec, std::string) {
+                if(!ec)
+                    ++self->_done;
+                self->run();
+            });
+    }
+
+private:
+    std::shared_ptr<http::Client>   _client;
+    std::atomic<bool>&              _stop;
+    std::atomic<uint64_t>&          _done;
+    http::Request                   _request = {"/bench", {}, {}, {}};
+};
+
+}
+
+int main(int argc, char** argv)
+{
+    std::size_t maxThreads = argc > 1 ? std::stoul(argv[1]) : std::thread::hardware_concurrency();
+    bool reactorPerThread = argc > 2 && std::string(argv[2]) == "reactor";
+    auto duration = std::chrono::seconds(argc > 3 ? std::stoul(argv[3]) : 5);
+    std::size_t connections = argc > 4 ? std::stoul(argv[4]) : 64;
+
+    // The load generator has its own threads so that only the server side is scaled
+    http::Factory client({std::max<std::size_t>(maxThreads, 1), true, false});
+
+    std::cout << "threads,requests_per_second\n";
+
+    for(std::size_t threads = 1; threads <= maxThreads; ++threads) {
+        http::Factory factory({threads, reactorPerThread, reactorPerThread});
+
+        uint16_t port = uint16_t(18000 + threads);
+        auto server = factory.getServer("127.0.0.1", port);
+        server->setCallback([](http::Request const&) {
+            http::Response response;
+            response.body = "ok";
+            return response;
+        });
+
+        if(!server->run())
+            return 1;
+
+        std::atomic<bool> stop = false;
+        std::atomic<uint64_t> done = 0;
+
+        for(std::size_t i = 0; i < connections; ++i)
+            std::make_shared<Worker>(client.getClient("127.0.0.1", port), stop, done)->run();
+
+        // Skip connection setup before measuring
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        uint64_t start = done;
+        std::this_thread::sleep_for(duration);
+        uint64_t count = done - start;
+
+        stop = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+        std::cout << threads << "," << double(count) / duration.count() << std::endl;
+    }
+
+    return 0;
+}
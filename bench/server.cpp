@@ -0,0 +1,118 @@
+// Loopback Server for http_bench, runs until interrupted.
+//
+//   http_bench_server [--port=18400] [--host=127.0.0.1] [--threads=2] [--reactor] [--reuse-port]
+//                     [--handler=fixed|echo|view|file|async] [--response-bytes=2] [--file=path]
+//                     [--delay-ms=1] [--workers=0] [--compression=0] [--http2]
+//                     [--cert=cert.pem --key=key.pem] [--metrics=/metrics]
+//                     [--access-log=path] [--log-sample=1]
+//
+// A self-signed pair for HTTPS, http_bench takes the certificate as --ca:
+//
+//   openssl req -x509 -newkey rsa:2048 -nodes -keyout key.pem -out cert.pem -days 30
+//       -subj /CN=localhost -addext subjectAltName=IP:127.0.0.1   (one line)
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+#include "http/factory.hpp"
+
+#include "arguments.hpp"
+#include "handlers.hpp"
+
+int main(int argc, char** argv)
+{
+    bench::Arguments args(argc, argv);
+
+    auto name = args.get("handler", std::string("fixed"));
+    auto handler = bench::handlers().find(name);
+    if(handler == bench::handlers().end()) {
+        std::cerr << "Unknown handler " << name << ", one of:";
+        for(auto const& [known, install]: bench::handlers())
+            std::cerr << " " << known;
+        std::cerr << "\n";
+        return 1;
+    }
+
+    bool reactor = args.flag("reactor");
+    http::Factory factory({args.get("threads", uint64_t(2)), reactor, reactor});
+
+    auto host = args.get("host", std::string("127.0.0.1"));
+    auto port = uint16_t(args.get("port", uint64_t(18400)));
+    auto server = factory.getServer(host, port);
+
+    http::Server::Options options;
+    options.reusePort = args.flag("reuse-port");
+    options.http2 = args.flag("http2");
+    options.compressionLevel = int(args.get("compression", uint64_t(0)));
+    options.maxRequests = args.get("max-requests", uint64_t(0));
+    options.limits.bodySize = args.get("body-limit", options.limits.bodySize);
+    options.metricsTarget = args.get("metrics", std::string());
+    server->setOptions(options);
+
+    // Server metrics cost clock reads per request, they are kept only when served
+    // or for the handshake counts printed on exit
+    std::shared_ptr<http::ServerMetrics> metrics;
+    if(!options.metricsTarget.empty() || args.has("cert")) {
+        metrics = std::make_shared<http::ServerMetrics>();
+        server->setMetrics(metrics);
+    }
+
+    if(auto workers = args.get("workers", uint64_t(0)))
+        server->setWorkerPool(std::make_shared<http::WorkerPool>(workers, 4096));
+
+    if(args.has("cert")) {
+        auto cert = bench::readFile(args.get("cert", std::string()));
+        auto key = bench::readFile(args.get("key", std::string()));
+        if(!server->setCertificate(cert, key))
+            return 1;
+    }
+
+    // Lines are written on the log thread, - for stdout
+    std::shared_ptr<http::AccessLog> log;
+    if(args.has("access-log")) {
+        auto path = args.get("access-log", std::string());
+        auto file = path == "-" ? stdout : std::fopen(path.c_str(), "a");
+        if(!file) {
+            std::cerr << "Cannot open " << path << "\n";
+            return 1;
+        }
+
+        http::AccessLog::Options logOptions;
+        logOptions.sampleRate = uint32_t(args.get("log-sample", uint64_t(1)));
+        log = std::make_shared<http::AccessLog>(
+            [file](std::string_view lines) {
+                std::fwrite(lines.data(), 1, lines.size(), file);
+                std::fflush(file);
+            },
+            logOptions);
+        server->setAccessLog(log);
+    }
+
+    handler->second(*server, args);
+
+    if(!server->run())
+        return 1;
+
+    std::cout << "Serving " << name << " on " << host << ":" << port
+              << (args.has("cert") ? " with TLS" : "") << std::endl;
+
+    boost::asio::io_context signals;
+    boost::asio::signal_set set(signals, SIGINT, SIGTERM);
+    set.async_wait([](boost::beast::error_code, int) {});
+    signals.run();
+
+    if(args.has("cert")) {
+        std::cout << "handshakes full " << metrics->handshakesFull.value()
+                  << ", resumed " << metrics->handshakesResumed.value()
+                  << ", failed " << metrics->handshakesFailed.value() << std::endl;
+    }
+
+    if(log) {
+        auto stats = log->stats();
+        std::cout << "access log " << stats.logged
+                  << ", dropped " << stats.dropped << std::endl;
+    }
+
+    return 0;
+}
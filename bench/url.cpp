@@ -0,0 +1,133 @@
+// Building and reading query strings. Clients used to concatenate the target
+// pair by pair with temporaries and no encoding, handlers split the query
+// themselves; url::makeTarget encodes into one allocation and Query looks up
+// a single parameter without parsing the others. Heap allocations are counted.
+//
+//   http_bench_url [iterations]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+
+#include "http/url.hpp"
+
+namespace
+{
+
+std::atomic<uint64_t> allocations = 0;
+
+}
+
+void* operator new(std::size_t size)
+{
+    ++allocations;
+
+    if(void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+std::string concatenate(std::string const& path, http::ParamMap const& params)
+{
+    std::string target = path;
+    if(params.size()) {
+        target += "?";
+        for(auto& [key, value]: params)
+            target += key + "=" + value + "&";
+        target.pop_back();
+    }
+    return target;
+}
+
+// Splits every pair into a map to read one of them
+std::string split(std::string_view target, std::string_view wanted)
+{
+    http::ParamMap params;
+    auto query = target.substr(std::min(target.find('?') + 1, target.size()));
+    while(!query.empty()) {
+        auto pair = query.substr(0, query.find('&'));
+        auto equal = std::min(pair.find('='), pair.size());
+        params[std::string(pair.substr(0, equal))] = std::string(pair.substr(std::min(equal + 1, pair.size())));
+        query.remove_prefix(std::min(pair.size() + 1, query.size()));
+    }
+    return std::string(params.get(wanted));
+}
+
+template<typename Function>
+void measure(char const* name, std::size_t iterations, std::size_t& sink, Function&& function)
+{
+    allocations = 0;
+    auto start = Clock::now();
+    for(std::size_t i = 0; i < iterations; ++i)
+        sink += function();
+    auto elapsed = Clock::now() - start;
+    uint64_t allocated = allocations;
+
+    std::cout << name << ","
+              << double(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / double(iterations) << ","
+              << double(allocated) / double(iterations) << std::endl;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    std::size_t iterations = argc > 1 ? std::stoul(argv[1]) : 1000000;
+
+    std::string path = "/api/v1/search";
+    http::ParamMap params;
+    params["q"] = "flat white";
+    params["page"] = "3";
+    params["size"] = "50";
+    params["sort"] = "price";
+    params["order"] = "desc";
+    params["lang"] = "en";
+    params["region"] = "eu-west";
+    params["session"] = "4f2a9c1e7b3d";
+
+    std::string target = http::url::makeTarget(path, params);
+
+    std::cout << "case,ns_per_op,allocations_per_op\n";
+
+    std::size_t sink = 0;
+
+    measure("build_concatenate", iterations, sink, [&] { return concatenate(path, params).size(); });
+    measure("build_make_target", iterations, sink, [&] { return http::url::makeTarget(path, params).size(); });
+
+    measure("lookup_split", iterations, sink, [&] { return split(target, "sort").size(); });
+    measure("lookup_parse_query", iterations, sink, [&] {
+        http::ParamMap parsed;
+        http::url::parseQuery(target, parsed);
+        return parsed.get("sort").size();
+    });
+
+    std::string buffer;
+    measure("lookup_query_plain", iterations, sink, [&] {
+        return http::Query(target).get("sort", buffer).size();
+    });
+    measure("lookup_query_encoded", iterations, sink, [&] {
+        return http::Query(target).get("q", buffer).size();
+    });
+
+    // Keeps the loops from being optimized away
+    return sink == 0;
+}
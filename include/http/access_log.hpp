@@ -0,0 +1,121 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include <boost/asio/ip/address.hpp>
+
+using namespace std::chrono_literals;
+
+namespace http
+{
+
+// Access log kept off the io threads. A served request leaves a fixed-size record in a
+// bounded lock-free ring, a background thread formats the records in the Common Log
+// Format with the duration appended and hands them to the writer in batches.
+// Records finding the ring full are dropped and counted, never waited for
+class AccessLog
+{
+public:
+    // Receives whole lines, on the background thread only
+    using WriterType = std::function<void(std::string_view lines)>;
+
+    struct Options
+    {
+        // Records the ring holds, rounded up to a power of two, 192 bytes each
+        std::size_t                 capacity = 16 * 1024;
+        // One request in every sampleRate is logged, per io thread
+        uint32_t                    sampleRate = 1;
+        // Time the background thread sleeps once the ring is empty
+        std::chrono::milliseconds   flushInterval = 100ms;
+    };
+
+    struct Record
+    {
+        static constexpr std::size_t targetCapacity = 128;
+
+        // Microseconds since the epoch when the request was read, and until its response was sent
+        int64_t                     time = 0;
+        uint32_t                    duration = 0;
+        uint16_t                    status = 0;
+        uint16_t                    method = 0;
+        uint8_t                     version = 11;
+        uint8_t                     targetSize = 0;
+        // Response bytes handed to the socket, the header included
+        uint64_t                    bytes = 0;
+        boost::asio::ip::address_v6::bytes_type address{};
+        bool                        v4 = true;
+        // Truncated beyond the capacity
+        std::array<char, targetCapacity> target;
+
+        void setTarget(std::string_view value);
+        void setAddress(boost::asio::ip::address const& value);
+    };
+
+    struct Stats
+    {
+        uint64_t    logged = 0;
+        uint64_t    dropped = 0;
+    };
+
+public:
+    explicit AccessLog(WriterType writer);
+    AccessLog(WriterType writer, Options const& options);
+    // Whatever is still in the ring is written first
+    ~AccessLog();
+
+    // Decides per request whether it is logged, cheap enough to ask for every one
+    bool sample() const;
+
+    // Lock-free, false when the ring is full
+    bool push(Record const& record);
+
+    Stats stats() const;
+
+    static int64_t now();
+
+private:
+    struct alignas(64) Cell
+    {
+        std::atomic<std::size_t>    sequence = 0;
+        Record                      record;
+    };
+
+    void _run();
+    // Formats and writes one batch, false when there was nothing to write
+    bool _drain();
+    void _format(Record const& record);
+
+private:
+    WriterType                      _writer;
+    Options                         _options;
+
+    std::unique_ptr<Cell[]>         _cells;
+    std::size_t                     _mask = 0;
+    alignas(64) std::atomic<std::size_t> _head = 0;
+    alignas(64) std::size_t         _tail = 0;
+
+    std::atomic<uint64_t>           _logged = 0;
+    std::atomic<uint64_t>           _dropped = 0;
+
+    // Only the background thread formats
+    std::string                     _buffer;
+    int64_t                         _second = -1;
+    std::string                     _date;
+
+    std::mutex                      _mutex;
+    std::condition_variable         _condition;
+    bool                            _stop = false;
+    std::thread                     _thread;
+};
+
+}
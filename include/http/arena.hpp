@@ -0,0 +1,182 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace http
+{
+
+struct AllocatorStats
+{
+    // Served from session arenas
+    uint64_t    arenaAllocations = 0;
+    uint64_t    arenaBytes = 0;
+    // Did not fit into the arena and went to the heap
+    uint64_t    fallbackAllocations = 0;
+    uint64_t    fallbackBytes = 0;
+    // Times an arena was rewound after everything in it was freed
+    uint64_t    arenaResets = 0;
+    // Sessions and buffers taken from a freelist or newly allocated
+    uint64_t    recycled = 0;
+    uint64_t    fresh = 0;
+};
+
+// Bump allocator for the per-request state of one session. Allocation happens on
+// the session strand only, memory may be freed from any thread. The arena rewinds
+// once everything allocated from it was freed, which between requests is the normal case
+class Arena
+{
+public:
+    explicit Arena(std::size_t size);
+    ~Arena();
+
+    Arena(Arena const&) = delete;
+    Arena& operator=(Arena const&) = delete;
+
+    void* allocate(std::size_t size, std::size_t align);
+    void deallocate(void* p, std::size_t size) noexcept;
+
+    static AllocatorStats stats();
+    static void countRecycled(bool recycled);
+
+private:
+    std::unique_ptr<std::byte[]>    _buffer;
+    std::size_t                     _size;
+    std::size_t                     _offset = 0;
+    std::atomic<std::size_t>        _live = 0;
+
+    // Folded into the global statistics when the arena goes away
+    AllocatorStats                  _stats;
+};
+
+// Allocator over a shared arena, a default-constructed one uses the heap
+template<typename T>
+class ArenaAllocator
+{
+public:
+    using value_type = T;
+
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    template<typename U>
+    struct rebind
+    {
+        using other = ArenaAllocator<U>;
+    };
+
+public:
+    ArenaAllocator() noexcept = default;
+
+    explicit ArenaAllocator(std::shared_ptr<Arena> arena) noexcept
+        : _arena(std::move(arena))
+    {}
+
+    template<typename U>
+    ArenaAllocator(ArenaAllocator<U> const& other) noexcept
+        : _arena(other.arena())
+    {}
+
+    T* allocate(std::size_t n)
+    {
+        if(!_arena)
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        return static_cast<T*>(_arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        if(!_arena)
+            return ::operator delete(p);
+        _arena->deallocate(p, n * sizeof(T));
+    }
+
+    std::shared_ptr<Arena> const& arena() const noexcept { return _arena; }
+
+    template<typename U>
+    bool operator==(ArenaAllocator<U> const& other) const noexcept { return _arena == other.arena(); }
+    template<typename U>
+    bool operator!=(ArenaAllocator<U> const& other) const noexcept { return _arena != other.arena(); }
+
+private:
+    std::shared_ptr<Arena>  _arena;
+};
+
+// Recycles single-object allocations of one type through a per-thread freelist,
+// meant for std::allocate_shared of objects created and dropped at a high rate
+template<typename T>
+class FreeListAllocator
+{
+public:
+    using value_type = T;
+
+    template<typename U>
+    struct rebind
+    {
+        using other = FreeListAllocator<U>;
+    };
+
+public:
+    FreeListAllocator() noexcept = default;
+
+    template<typename U>
+    FreeListAllocator(FreeListAllocator<U> const&) noexcept
+    {}
+
+    T* allocate(std::size_t n)
+    {
+        auto& blocks = _blocks();
+        if(n == 1 && !blocks.empty()) {
+            void* p = blocks.back();
+            blocks.pop_back();
+            Arena::countRecycled(true);
+            return static_cast<T*>(p);
+        }
+
+        Arena::countRecycled(false);
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        auto& blocks = _blocks();
+        if(n == 1 && blocks.size() < _limit) {
+            blocks.push_back(p);
+            return;
+        }
+
+        ::operator delete(p);
+    }
+
+    template<typename U>
+    bool operator==(FreeListAllocator<U> const&) const noexcept { return true; }
+    template<typename U>
+    bool operator!=(FreeListAllocator<U> const&) const noexcept { return false; }
+
+private:
+    struct Blocks
+        : std::vector<void*>
+    {
+        ~Blocks()
+        {
+            for(void* p: *this)
+                ::operator delete(p);
+        }
+    };
+
+    static Blocks& _blocks()
+    {
+        static thread_local Blocks blocks;
+        return blocks;
+    }
+
+private:
+    static constexpr std::size_t    _limit = 1024;
+};
+
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "client.hpp"
+
+using namespace std::chrono_literals;
+
+namespace http
+{
+
+namespace asio = boost::asio;
+
+// Fans calls to any number of hosts out at once and gathers their results, so that
+// a batch takes as long as its slowest call instead of all of them in a row.
+// Connections are kept per host:port between batches and shared by the batches
+// running at the same time
+class BatchClient
+    : public std::enable_shared_from_this<BatchClient>
+{
+public:
+    using CreatorType = std::function<std::shared_ptr<Client>(std::string_view host, uint16_t port)>;
+
+    struct Call
+    {
+        std::string             host = "127.0.0.1";
+        uint16_t                port = 80;
+        http::verb              method = http::verb::get;
+        Request                 request;
+    };
+
+    struct Result
+    {
+        // asio::error::timed_out when the deadline came first, operation_aborted
+        // when the batch had enough results before the call completed
+        beast::error_code       error;
+        std::string             body;
+        // From the start of the batch to the call completing
+        std::chrono::microseconds elapsed{0};
+    };
+
+    struct Options
+    {
+        // Calls in flight to one host:port, the others wait for a connection
+        std::size_t                 maxPerHost = 6;
+        // The batch completes by then whatever calls are still running, 0 for no deadline.
+        // Those keep their connection until they complete within the client timeout
+        std::chrono::milliseconds   deadline = 10s;
+        // The batch completes once this many calls succeeded, 0 waits for all of them
+        std::size_t                 quorum = 0;
+    };
+
+    using HandlerType = std::function<void(std::vector<Result>)>;
+
+public:
+    BatchClient(asio::io_context& ioc, CreatorType creator);
+
+    // Applies to the batches started from then on
+    void setOptions(Options const& options);
+
+    // Blocking, must not be made from a thread running the io_context.
+    // Results are in the order of the calls
+    std::vector<Result> run(std::vector<Call> calls);
+
+    // Non-blocking, completing with void(std::vector<Result>)
+    template<typename CompletionToken>
+    auto async_run(std::vector<Call> calls, CompletionToken&& token);
+
+private:
+    struct Batch;
+    using BatchPtr = std::shared_ptr<Batch>;
+
+    struct Host
+    {
+        std::size_t                         connections = 0;
+        std::vector<std::shared_ptr<Client>> idle;
+        // Calls of any batch waiting for a connection, in arrival order
+        std::deque<std::pair<BatchPtr, std::size_t>> waiting;
+    };
+
+    template<typename Handler>
+    HandlerType _wrap(Handler&& handler);
+
+    void _start(std::vector<Call>&& calls, HandlerType handler);
+    void _issue(Host& host, std::string const& key, BatchPtr const& batch, std::size_t index);
+    void _send(std::shared_ptr<Client> client, std::string const& key, BatchPtr const& batch, std::size_t index);
+    void _onCall(
+        std::shared_ptr<Client> client, std::string const& key, BatchPtr const& batch, std::size_t index,
+        beast::error_code ec, std::string body);
+    void _onDeadline(BatchPtr const& batch, beast::error_code ec);
+    void _finish(Batch& batch, beast::error_code const& pending);
+
+private:
+    asio::strand<asio::io_context::executor_type> _strand;
+    CreatorType                             _creator;
+    Options                                 _options;
+
+    // Touched on the strand only
+    std::unordered_map<std::string, Host>   _hosts;
+};
+
+template<typename CompletionToken>
+auto BatchClient::async_run(std::vector<Call> calls, CompletionToken&& token)
+{
+    return asio::async_initiate<CompletionToken, void(std::vector<Result>)>(
+        [self = shared_from_this()](auto handler, std::vector<Call> calls) {
+            self->_start(std::move(calls), self->_wrap(std::move(handler)));
+        },
+        token, std::move(calls));
+}
+
+template<typename Handler>
+BatchClient::HandlerType BatchClient::_wrap(Handler&& handler)
+{
+    // As the clients do, the handler is invoked on its own executor
+    auto executor = asio::get_associated_executor(handler, _strand);
+    auto work = std::make_shared<decltype(asio::make_work_guard(executor))>(executor);
+    auto shared = std::make_shared<std::decay_t<Handler>>(std::forward<Handler>(handler));
+
+    return [shared, work](std::vector<Result> results) {
+        auto executor = work->get_executor();
+        asio::dispatch(
+            executor,
+            [shared, work, results = std::move(results)]() mutable {
+                (*shared)(std::move(results));
+                work->reset();
+            });
+    };
+}
+
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace http
+{
+
+enum class Encoding
+{
+    identity,
+    gzip,
+    deflate,
+};
+
+// Content-Encoding token of an encoding and back, unknown tokens give identity
+std::string_view toString(Encoding encoding);
+Encoding parseEncoding(std::string_view value);
+
+// Picks gzip or deflate from an Accept-Encoding value by quality, identity when neither fits
+Encoding negotiate(std::string_view acceptEncoding);
+
+// Compression streams are kept per thread and reset between bodies
+bool compress(std::string_view data, Encoding encoding, int level, std::string& out);
+// Fails instead of inflating beyond the limit
+bool decompress(std::string_view data, Encoding encoding, uint64_t limit, std::string& out);
+
+// Thread-safe cache of compressed bodies of static responses, keyed by request target and
+// entity tag, as handlers pick their tags independently. An entry compressed from a body of
+// another size is not served. The least recently used bodies go first once the cache is over its size
+class CompressionCache
+{
+public:
+    using Body = std::shared_ptr<std::string const>;
+
+    struct Options
+    {
+        std::size_t     maxEntries = 1024;
+        std::size_t     maxBytes = 64 * 1024 * 1024;
+    };
+
+public:
+    void setOptions(Options const& options);
+
+    // The size is that of the uncompressed body
+    Body get(std::string_view target, std::string_view etag, Encoding encoding, int level, std::size_t size);
+    void store(std::string_view target, std::string_view etag, Encoding encoding, int level, std::size_t size, Body body);
+
+    void clear();
+
+private:
+    using Lru = std::list<std::string>;
+
+    struct Entry
+    {
+        Body            body;
+        std::size_t     source = 0;
+        Lru::iterator   position;
+    };
+
+    static std::string _key(std::string_view target, std::string_view etag, Encoding encoding, int level);
+
+    void _evict();
+
+private:
+    Options                                 _options;
+
+    std::mutex                              _mutex;
+    std::unordered_map<std::string, Entry>  _entries;
+    Lru                                     _lru;
+    std::size_t                             _bytes = 0;
+};
+
+}
@@ -1,9 +1,13 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
 
+#include "batch_client.hpp"
 #include "client.hpp"
+#include "http2_client.hpp"
 #include "ssl_client.hpp"
+#include "pool.hpp"
 
 #include "server.hpp"
 
@@ -15,24 +19,67 @@ namespace asio = boost::asio;
 class Factory
     : std::enable_shared_from_this<Factory>
 {
+public:
+    struct Options
+    {
+        // Threads running the io_contexts, 0 for one per hardware thread
+        std::size_t     threads = 2;
+        // Give every thread its own io_context instead of sharing one
+        bool            reactorPerThread = false;
+        // Pin every thread to its own CPU, Linux only
+        bool            pinThreads = false;
+    };
+
 public:
     static std::shared_ptr<Factory> getFactory();
 
     Factory();
+    Factory(Options const& options);
     virtual ~Factory();
 
     bool addCertificate(std::string_view cert);
 
     std::shared_ptr<Client>     getClient(std::string_view host = "127.0.0.1", uint16_t port = 80);
     std::shared_ptr<SslClient>  getSslClient(std::string_view host = "127.0.0.1", uint16_t port = 443);
+    // One connection carries all concurrent calls, h2c in plaintext and h2 through ALPN over TLS
+    std::shared_ptr<Http2Client> getHttp2Client(std::string_view host = "127.0.0.1", uint16_t port = 80);
+    std::shared_ptr<Http2Client> getHttp2SslClient(std::string_view host = "127.0.0.1", uint16_t port = 443);
+
+    TlsSessionCache::Stats      getTlsStats() const;
+
+    void                        setResolveOptions(ResolveCache::Options const& options);
+
+    // Shared by the HTTP/1.1 clients created from then on, pooled ones included
+    void                        setMetrics(std::shared_ptr<ClientMetrics> metrics);
+
+    void                        setPoolOptions(ClientPool::Options const& options);
+    ClientPool::Lease           getPooledClient(std::string_view host = "127.0.0.1", uint16_t port = 80);
+
+    // Connections it opens are spread over the io_contexts as the clients from getClient
+    std::shared_ptr<BatchClient> getBatchClient(BatchClient::Options const& options = {});
 
     std::shared_ptr<Server>     getServer(std::string_view host = "0.0.0.0", uint16_t port = 7500);
 
 private:
-    asio::io_context            _ioc;
-    asio::io_context::work      _work;
-    asio::ssl::context          _ctx;
-    std::vector<std::thread>    _threads;
+    // Clients are spread over the io_contexts round-robin
+    asio::io_context& _nextReactor();
+
+    void _pin(std::thread& thread, std::size_t index);
+
+private:
+    using Reactor = std::unique_ptr<asio::io_context>;
+    using WorkGuard = asio::executor_work_guard<asio::io_context::executor_type>;
+
+    std::vector<Reactor>                _reactors;
+    std::vector<WorkGuard>              _works;
+    std::atomic<std::size_t>            _next = 0;
+    asio::ssl::context                  _ctx;
+    std::vector<std::thread>            _threads;
+
+    std::shared_ptr<TlsSessionCache>    _sessionCache;
+    std::shared_ptr<ResolveCache>       _resolveCache;
+    std::shared_ptr<ClientMetrics>      _metrics;
+    std::shared_ptr<ClientPool>         _pool;
 };
 
 }
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+using namespace std::chrono_literals;
+
+namespace http
+{
+
+// Thread-safe cache of the open files a Server sends, shared by its sessions.
+// An entry is checked against the file system again once it is older than the validity,
+// the least recently used files go first once the cache is full
+class FileCache
+{
+public:
+    struct File
+    {
+        File() = default;
+        File(File const&) = delete;
+        File& operator=(File const&) = delete;
+        ~File();
+
+        int             fd = -1;
+        uint64_t        size = 0;
+        uint64_t        inode = 0;
+        std::time_t     modified = 0;
+        // Validators sent with the file
+        std::string     etag;
+        std::string     lastModified;
+    };
+
+    struct Options
+    {
+        std::chrono::seconds    validity = 5s;
+        std::size_t             maxEntries = 1024;
+    };
+
+public:
+    void setOptions(Options const& options);
+
+    // Null when the path is not a readable regular file, errno tells why
+    std::shared_ptr<File const> open(std::string const& path);
+
+    void invalidate(std::string const& path);
+
+private:
+    using Clock = std::chrono::steady_clock;
+    using Lru = std::list<std::string>;
+
+    struct Entry
+    {
+        std::shared_ptr<File const> file;
+        Clock::time_point           checked;
+        Lru::iterator               position;
+    };
+
+    using Entries = std::unordered_map<std::string, Entry>;
+
+    static std::shared_ptr<File const> _open(std::string const& path);
+
+    void _insert(std::string const& path, std::shared_ptr<File const> file, Clock::time_point checked);
+    void _erase(Entries::iterator it);
+    void _evict();
+
+private:
+    Options                                 _options;
+
+    std::mutex                              _mutex;
+    Entries                                 _entries;
+    Lru                                     _lru;
+};
+
+}
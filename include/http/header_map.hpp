@@ -0,0 +1,177 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include <boost/beast/http/field.hpp>
+#include <boost/container/small_vector.hpp>
+
+namespace http
+{
+
+namespace http = boost::beast::http;
+
+struct Header
+{
+    std::string     key;
+    std::string     value;
+};
+
+// Flat map for the few entries of a header or query string. Entries keep their
+// insertion order and live inline up to N of them. Lookup is a linear scan over
+// a dense array of hashes, well-known field names hash to their beast field
+// so that lookups by http::field compare no strings at all
+template<std::size_t N, bool IgnoreCase>
+class FlatMap
+{
+public:
+    using Entries = boost::container::small_vector<Header, N>;
+    using const_iterator = typename Entries::const_iterator;
+
+public:
+    const_iterator begin() const { return _entries.begin(); }
+    const_iterator end() const { return _entries.end(); }
+
+    std::size_t size() const { return _entries.size(); }
+    bool empty() const { return _entries.empty(); }
+
+    void reserve(std::size_t size)
+    {
+        _entries.reserve(size);
+        _hashes.reserve(size);
+    }
+
+    void clear()
+    {
+        _entries.clear();
+        _hashes.clear();
+    }
+
+    const_iterator find(std::string_view key) const
+    {
+        return begin() + _find(_hash(key), key);
+    }
+
+    const_iterator find(http::field name) const
+    {
+        static_assert(IgnoreCase, "Well-known fields only apply to header maps");
+        if(name == http::field::unknown)
+            return end();
+        return begin() + _find(uint32_t(name), {});
+    }
+
+    template<typename Key>
+    bool contains(Key const& key) const { return find(key) != end(); }
+
+    template<typename Key>
+    std::size_t count(Key const& key) const { return contains(key) ? 1 : 0; }
+
+    // Empty when the key is missing
+    template<typename Key>
+    std::string_view get(Key const& key) const
+    {
+        auto it = find(key);
+        return it == end() ? std::string_view() : std::string_view(it->value);
+    }
+
+    std::string& operator[](std::string_view key)
+    {
+        auto hash = _hash(key);
+        auto i = _find(hash, key);
+        if(i == size())
+            _append(hash, std::string(key), {});
+        return _entries[i].value;
+    }
+
+    void set(std::string_view key, std::string value)
+    {
+        (*this)[key] = std::move(value);
+    }
+
+    // For keys whose field is already known, e.g. from a parsed message
+    void set(http::field name, std::string key, std::string value)
+    {
+        static_assert(IgnoreCase, "Well-known fields only apply to header maps");
+        auto hash = name == http::field::unknown ? _hash(key) : uint32_t(name);
+        auto i = _find(hash, key);
+        if(i == size())
+            _append(hash, std::move(key), std::move(value));
+        else
+            _entries[i].value = std::move(value);
+    }
+
+    bool erase(std::string_view key)
+    {
+        auto i = _find(_hash(key), key);
+        if(i == size())
+            return false;
+
+        _entries.erase(_entries.begin() + i);
+        _hashes.erase(_hashes.begin() + i);
+        return true;
+    }
+
+private:
+    // Unknown names have the top bit set so they never collide with a field
+    static constexpr uint32_t _unknown = 0x80000000u;
+
+    static char _fold(char c)
+    {
+        return IgnoreCase && c >= 'A' && c <= 'Z' ? char(c + ('a' - 'A')) : c;
+    }
+
+    static uint32_t _hash(std::string_view key)
+    {
+        if constexpr(IgnoreCase) {
+            auto name = http::string_to_field({key.data(), key.size()});
+            if(name != http::field::unknown)
+                return uint32_t(name);
+        }
+
+        // FNV-1a
+        uint32_t hash = 2166136261u;
+        for(char c: key)
+            hash = (hash ^ uint8_t(_fold(c))) * 16777619u;
+        return hash | _unknown;
+    }
+
+    static bool _equal(std::string_view a, std::string_view b)
+    {
+        if(a.size() != b.size())
+            return false;
+        for(std::size_t i = 0; i < a.size(); ++i)
+            if(_fold(a[i]) != _fold(b[i]))
+                return false;
+        return true;
+    }
+
+    std::size_t _find(uint32_t hash, std::string_view key) const
+    {
+        for(std::size_t i = 0; i < _hashes.size(); ++i) {
+            if(_hashes[i] != hash)
+                continue;
+            // Equal hashes of well-known fields mean equal names
+            if(!(hash & _unknown) || _equal(_entries[i].key, key))
+                return i;
+        }
+        return size();
+    }
+
+    void _append(uint32_t hash, std::string&& key, std::string&& value)
+    {
+        _entries.push_back({std::move(key), std::move(value)});
+        _hashes.push_back(hash);
+    }
+
+private:
+    Entries                                     _entries;
+    boost::container::small_vector<uint32_t, N> _hashes;
+};
+
+// Case-insensitive, sized for the headers of a typical request
+using HeaderMap = FlatMap<16, true>;
+// Case-sensitive, as query parameters are
+using ParamMap = FlatMap<8, false>;
+
+}
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <deque>
+#include <future>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/beast.hpp>
+#include <boost/beast/ssl.hpp>
+
+#include "compression.hpp"
+#include "message.hpp"
+#include "resolve_cache.hpp"
+#include "tls_session_cache.hpp"
+
+using namespace std::chrono_literals;
+
+struct nghttp2_session;
+
+namespace http
+{
+
+namespace asio  = boost::asio;
+namespace beast = boost::beast;
+namespace http  = boost::beast::http;
+
+// HTTP/2 client of one host. Concurrent calls share a single connection, each
+// request is a stream of its own, so none waits for the response of another
+class Http2Client
+    : public std::enable_shared_from_this<Http2Client>
+{
+public:
+    // Plaintext connections start HTTP/2 right away (prior knowledge, h2c)
+    Http2Client(asio::io_context& ioc);
+    // TLS connections agree on h2 through ALPN, a server not selecting it fails the call
+    Http2Client(asio::io_context& ioc, asio::ssl::context& ctx);
+
+    void setup(std::string_view host, uint16_t port);
+    // Longest time without any progress on the connection while streams are open
+    void setTimeout(std::chrono::seconds timeout);
+    void setResolveCache(std::shared_ptr<ResolveCache> cache);
+    void setSessionCache(std::shared_ptr<TlsSessionCache> cache);
+    // Responses over the limits fail with http::error::header_limit or body_limit
+    void setLimits(Limits const& limits);
+    // Ask for gzip or deflate and decode such responses, on by default.
+    // Streamed responses are never encoded
+    void setDecompression(bool enabled);
+
+    bool isConnected() const;
+
+    // Blocking calls, must not be made from a thread running the io_context
+    bool get(Request const& request, std::string& response);
+    bool post(Request const& request, std::string& response);
+    // The response body goes to the sink as it arrives instead of into memory
+    bool get(Request const& request, SinkType sink);
+    bool post(Request const& request, SinkType sink);
+
+    // Non-blocking calls completing with void(beast::error_code, std::string),
+    // usable with callbacks, asio::use_future and asio::use_awaitable
+    template<typename CompletionToken>
+    auto async_get(Request const& request, CompletionToken&& token);
+    template<typename CompletionToken>
+    auto async_post(Request const& request, CompletionToken&& token);
+    // Streaming variants, completing with an empty body once the sink got all of it
+    template<typename CompletionToken>
+    auto async_get(Request const& request, SinkType sink, CompletionToken&& token);
+    template<typename CompletionToken>
+    auto async_post(Request const& request, SinkType sink, CompletionToken&& token);
+
+private:
+    using HandlerType = std::function<void(beast::error_code, std::string)>;
+    using Clock = std::chrono::steady_clock;
+    using SslStream = beast::ssl_stream<beast::tcp_stream>;
+
+    struct SessionDelete
+    {
+        void operator()(nghttp2_session* session) const;
+    };
+
+    struct Operation
+    {
+        // Pseudo-headers first, names in lower case
+        std::vector<std::pair<std::string, std::string>> headers;
+        std::string         body;
+        SourceType          source;
+        SinkType            sink;
+        HandlerType         handler;
+
+        std::size_t         sent = 0;
+        std::size_t         headerSize = 0;
+        std::string         encoding;
+        std::string         response;
+        beast::error_code   error;
+        // Refused streams were not processed and are sent once more
+        bool                retried = false;
+    };
+
+    using OperationPtr = std::unique_ptr<Operation>;
+
+    OperationPtr _createOperation(Request const& request, http::verb method, SinkType sink = nullptr) const;
+
+    template<typename CompletionToken>
+    auto _async(OperationPtr operation, CompletionToken&& token);
+    template<typename Handler>
+    HandlerType _wrap(Handler&& handler);
+
+    bool _call(OperationPtr operation, std::string& response);
+    void _enqueue(OperationPtr operation);
+
+    void _run();
+    void _resolve();
+    void _connect();
+    void _start();
+    void _submit(OperationPtr operation);
+    void _read();
+    void _write();
+    void _watch();
+    void _close();
+
+    template<typename Function>
+    void _withStream(Function&& function);
+    beast::tcp_stream& _lowest();
+
+    void _onResolve(
+        beast::error_code ec,
+        asio::ip::tcp::resolver::results_type results);
+    void _onConnect(
+        beast::error_code ec,
+        asio::ip::tcp::resolver::results_type::endpoint_type endpoint);
+    void _onHandshake(beast::error_code ec);
+    void _onRead(std::size_t generation, beast::error_code ec, std::size_t bytes_transferred);
+    void _onWrite(std::size_t generation, beast::error_code ec, std::size_t bytes_transferred);
+    void _onTimer(beast::error_code ec);
+
+    // nghttp2 callbacks, defined with the glue code
+    struct Callbacks;
+
+    void _complete(OperationPtr operation);
+    void _completeAll();
+    void _fail(beast::error_code const& ec, bool queued);
+
+    void _processError(beast::error_code const& ec, std::string_view msg);
+
+private:
+    static constexpr uint64_t                   _payloadLimit = 2048;
+    static constexpr auto                       _defaultTimeout = 10s;
+    // Flow control windows announced to the server, large enough to keep a fast link busy
+    static constexpr int32_t                    _streamWindow = 1024 * 1024;
+    static constexpr int32_t                    _connectionWindow = 16 * 1024 * 1024;
+    static constexpr std::size_t                _writeSize = 64 * 1024;
+
+    asio::strand<asio::io_context::executor_type> _strand;
+    asio::ssl::context*                         _ctx = nullptr;
+    asio::ip::tcp::resolver                     _resolver;
+    std::shared_ptr<ResolveCache>               _cache;
+    std::shared_ptr<TlsSessionCache>            _sessions;
+    ResolveCache::Endpoints                     _endpoints;
+    // Recreated for every connection, pending operations of the previous one keep it alive
+    std::shared_ptr<beast::tcp_stream>          _tcp;
+    std::shared_ptr<SslStream>                  _ssl;
+    asio::steady_timer                          _timer;
+    std::unique_ptr<nghttp2_session, SessionDelete> _session;
+
+    std::deque<OperationPtr>                    _queue;
+    std::unordered_map<int32_t, OperationPtr>   _streams;
+    std::vector<OperationPtr>                   _done;
+    std::vector<char>                           _input;
+    std::string                                 _output;
+
+    std::string                                 _host;
+    uint16_t                                    _port;
+    std::chrono::seconds                        _timeout = _defaultTimeout;
+    Limits                                      _limits{8192, 8 * 1024 * 1024};
+    Clock::time_point                           _activity;
+    // Completions of a closed connection are told apart from the current one
+    std::size_t                                 _generation = 0;
+
+    bool                                        _connecting = false;
+    bool                                        _connected = false;
+    bool                                        _receiving = false;
+    bool                                        _writing = false;
+    bool                                        _storeSession = false;
+    bool                                        _decompression = true;
+};
+
+template<typename CompletionToken>
+auto Http2Client::async_get(Request const& request, CompletionToken&& token)
+{
+    return _async(
+        _createOperation(request, http::verb::get),
+        std::forward<CompletionToken>(token));
+}
+
+template<typename CompletionToken>
+auto Http2Client::async_post(Request const& request, CompletionToken&& token)
+{
+    return _async(
+        _createOperation(request, http::verb::post),
+        std::forward<CompletionToken>(token));
+}
+
+template<typename CompletionToken>
+auto Http2Client::async_get(Request const& request, SinkType sink, CompletionToken&& token)
+{
+    return _async(
+        _createOperation(request, http::verb::get, std::move(sink)),
+        std::forward<CompletionToken>(token));
+}
+
+template<typename CompletionToken>
+auto Http2Client::async_post(Request const& request, SinkType sink, CompletionToken&& token)
+{
+    return _async(
+        _createOperation(request, http::verb::post, std::move(sink)),
+        std::forward<CompletionToken>(token));
+}
+
+template<typename CompletionToken>
+auto Http2Client::_async(OperationPtr operation, CompletionToken&& token)
+{
+    return asio::async_initiate<CompletionToken, void(beast::error_code, std::string)>(
+        [self = shared_from_this()](auto handler, OperationPtr operation) {
+            operation->handler = self->_wrap(std::move(handler));
+            self->_enqueue(std::move(operation));
+        },
+        token, std::move(operation));
+}
+
+template<typename Handler>
+Http2Client::HandlerType Http2Client::_wrap(Handler&& handler)
+{
+    // The handler is invoked on its own executor and keeps it busy until then,
+    // it is shared to fit into a copyable std::function
+    auto executor = asio::get_associated_executor(handler, _strand);
+    auto work = std::make_shared<decltype(asio::make_work_guard(executor))>(executor);
+    auto shared = std::make_shared<std::decay_t<Handler>>(std::forward<Handler>(handler));
+
+    return [shared, work](beast::error_code ec, std::string body) {
+        auto executor = work->get_executor();
+        asio::dispatch(
+            executor,
+            [shared, work, ec, body = std::move(body)]() mutable {
+                (*shared)(ec, std::move(body));
+                work->reset();
+            });
+    };
+}
+
+}
@@ -1,28 +1,122 @@
 #pragma once
 
-#include <map>
+#include <cstdint>
+#include <functional>
 #include <string>
+#include <string_view>
 
 #include <boost/beast.hpp>
 
+#include "arena.hpp"
+#include "header_map.hpp"
+#include "url.hpp"
+
 namespace http
 {
 
 namespace http = boost::beast::http;
 
+// Header storage of server-side messages, allocated from the session arena
+using Fields = http::basic_fields<ArenaAllocator<char>>;
+
+// Parser limits and read buffer sizing of one connection
+struct Limits
+{
+    // Largest header accepted, the server answers 431 above it
+    uint32_t        headerSize = 8192;
+    // Largest body read into memory, the server answers 413 above it
+    uint64_t        bodySize = 1024 * 1024;
+    // Read buffer capacity reserved up front instead of grown by reallocation
+    std::size_t     bufferCapacity = 16 * 1024;
+    // Bytes the server asks from the socket while waiting for a request
+    std::size_t     readSize = 4096;
+};
+
+// Receives a streamed body piece by piece, returning false aborts the transfer
+using SinkType = std::function<bool(std::string_view chunk)>;
+// Fills the buffer with the next piece of a streamed body and returns its size, 0 ends the body
+using SourceType = std::function<std::size_t(char* data, std::size_t size)>;
+
+// Methods whose request may be sent again without changing the outcome
+inline bool idempotent(http::verb method)
+{
+    switch(method) {
+    case http::verb::get:
+    case http::verb::head:
+    case http::verb::options:
+    case http::verb::trace:
+    case http::verb::put:
+    case http::verb::delete_:
+        return true;
+    default:
+        return false;
+    }
+}
+
 struct Request
 {
-    std::string                         target;
-    std::map<std::string, std::string>  params;
-    std::map<std::string, std::string>  fields;
-    std::string                         body;
+    std::string     target;
+    // Percent-encoded into the target by clients, decoded from it by the server
+    ParamMap        params;
+    HeaderMap       fields;
+    std::string     body;
+    // Pulled instead of the body when set, sent chunked unless fields have a content-length
+    SourceType      source = nullptr;
+};
+
+// Read-only view of a received request, pointing into the parsed message.
+// Field lookup is case-insensitive and allocates nothing
+class RequestView
+{
+public:
+    using Message = http::request<http::string_body, Fields>;
+
+public:
+    explicit RequestView(Message const& request)
+        : _request(request)
+    {}
+
+    http::verb method() const { return _request.method(); }
+    std::string_view target() const { return _view(_request.target()); }
+    std::string_view body() const { return _request.body(); }
+
+    // Parameters are looked up in the target, decoding only the values asked for
+    Query query() const { return Query(target()); }
+
+    // Empty when the field is missing
+    std::string_view field(http::field name) const { return _find(_request.find(name)); }
+    std::string_view field(std::string_view name) const { return _find(_request.find({name.data(), name.size()})); }
+
+    bool has(http::field name) const { return _request.count(name) > 0; }
+    bool has(std::string_view name) const { return _request.count({name.data(), name.size()}) > 0; }
+
+    Message const& base() const { return _request; }
+
+private:
+    static std::string_view _view(boost::beast::string_view value)
+    {
+        return {value.data(), value.size()};
+    }
+
+    std::string_view _find(Message::const_iterator it) const
+    {
+        return it == _request.end() ? std::string_view() : _view(it->value());
+    }
+
+private:
+    Message const&  _request;
 };
 
 struct Response
 {
-    http::status                        result = http::status::ok;
-    std::map<std::string, std::string>  fields;
-    std::string                         body;
+    http::status    result = http::status::ok;
+    HeaderMap       fields;
+    std::string     body;
+    // Pulled instead of the body when set, sent with chunked transfer-encoding
+    SourceType      source = nullptr;
+    // Path of a file sent instead of the body. With an ok result the server answers
+    // ranges and conditional requests and adds the validators of the file
+    std::string     file;
 };
 
 }
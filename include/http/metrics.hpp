@@ -0,0 +1,202 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace http
+{
+
+// Lock-free instruments. Every thread records into a shard of its own, each on its
+// own cache line, and readers add the shards up. Durations are kept in microseconds
+namespace metrics
+{
+
+using Clock = std::chrono::steady_clock;
+
+constexpr std::size_t shards = 8;
+
+// Shard of the calling thread, threads are spread over them in the order they first record
+inline std::size_t shard()
+{
+    static std::atomic<std::size_t> next = 0;
+    thread_local std::size_t index = next++ % shards;
+    return index;
+}
+
+}
+
+class Counter
+{
+public:
+    void add(uint64_t value = 1)
+    {
+        _shards[metrics::shard()].value.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const
+    {
+        uint64_t total = 0;
+        for(auto const& shard: _shards)
+            total += shard.value.load(std::memory_order_relaxed);
+        return total;
+    }
+
+private:
+    struct alignas(64) Shard
+    {
+        std::atomic<uint64_t>   value = 0;
+    };
+
+    std::array<Shard, metrics::shards>  _shards;
+};
+
+// Goes up and down, possibly on different threads: a shard alone may be negative, the sum is not
+class Gauge
+{
+public:
+    void add(int64_t value = 1)
+    {
+        _shards[metrics::shard()].value.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    void sub(int64_t value = 1) { add(-value); }
+
+    int64_t value() const
+    {
+        int64_t total = 0;
+        for(auto const& shard: _shards)
+            total += shard.value.load(std::memory_order_relaxed);
+        return total;
+    }
+
+private:
+    struct alignas(64) Shard
+    {
+        std::atomic<int64_t>    value = 0;
+    };
+
+    std::array<Shard, metrics::shards>  _shards;
+};
+
+// Log-linear histogram in the manner of HdrHistogram: every power of two is split into
+// 32 sub-buckets, so a recorded value is reported within 3% of itself. Values above
+// about an hour of microseconds land in the last bucket
+class Histogram
+{
+public:
+    struct Snapshot
+    {
+        std::vector<uint64_t>   counts;
+        uint64_t                count = 0;
+        uint64_t                sum = 0;
+        // Exact, unlike the buckets
+        uint64_t                max = 0;
+
+        // Highest value of the bucket holding the given fraction of all recorded values,
+        // never above the largest one recorded
+        uint64_t percentile(double fraction) const;
+    };
+
+public:
+    Histogram();
+
+    void record(uint64_t value)
+    {
+        auto& shard = _shards[metrics::shard()];
+        shard.counts[_index(value)].fetch_add(1, std::memory_order_relaxed);
+        shard.sum.fetch_add(value, std::memory_order_relaxed);
+
+        auto max = shard.max.load(std::memory_order_relaxed);
+        while(value > max && !shard.max.compare_exchange_weak(max, value, std::memory_order_relaxed));
+    }
+
+    // Microseconds since start
+    void record(metrics::Clock::time_point start, metrics::Clock::time_point end = metrics::Clock::now())
+    {
+        record(uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count()));
+    }
+
+    Snapshot snapshot() const;
+
+private:
+    static constexpr unsigned       _subBits = 5;
+    static constexpr std::size_t    _subCount = std::size_t(1) << _subBits;
+    static constexpr unsigned       _maxBits = 32;
+    static constexpr std::size_t    _size = (_maxBits - _subBits + 1) * _subCount;
+
+    static std::size_t _index(uint64_t value)
+    {
+        if(value < 2 * _subCount)
+            return std::size_t(value);
+        if(value >> _maxBits)
+            return _size - 1;
+
+        unsigned shift = 63 - __builtin_clzll(value) - _subBits;
+        return shift * _subCount + std::size_t(value >> shift);
+    }
+
+    static uint64_t _highest(std::size_t index);
+
+private:
+    struct alignas(64) Shard
+    {
+        std::array<std::atomic<uint64_t>, _size>    counts{};
+        std::atomic<uint64_t>                       sum = 0;
+        std::atomic<uint64_t>                       max = 0;
+    };
+
+    // Some 7 KiB each, kept off the owner so that it stays small
+    std::vector<Shard>  _shards;
+};
+
+// Phases of the requests of all clients sharing it, measured on the io thread.
+// Resolve is only taken on an actual lookup and handshake only over TLS
+struct ClientMetrics
+{
+    Histogram   resolve;
+    Histogram   connect;
+    Histogram   handshake;
+    Histogram   write;
+    // From the request written to the response header read
+    Histogram   firstByte;
+    Histogram   read;
+
+    Counter     requests;
+    Counter     errors;
+    Counter     bytesSent;
+    Counter     bytesReceived;
+    Gauge       connections;
+
+    // Prometheus text exposition, names start with the prefix
+    std::string prometheus(std::string_view prefix = "http_client") const;
+};
+
+struct ServerMetrics
+{
+    // From the request handed to the worker pool to its handler starting
+    Histogram   queue;
+    Histogram   handler;
+    // From the response taking its turn to the last byte handed to the socket
+    Histogram   write;
+    // TLS handshakes that succeeded
+    Histogram   handshake;
+
+    Counter     accepted;
+    // Resumed ones skipped the key exchange with a session ticket
+    Counter     handshakesFull;
+    Counter     handshakesResumed;
+    Counter     handshakesFailed;
+    Counter     requests;
+    Counter     bytesReceived;
+    Counter     bytesSent;
+    Gauge       sessions;
+
+    std::string prometheus(std::string_view prefix = "http_server") const;
+};
+
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <boost/asio.hpp>
+
+#include "client.hpp"
+
+using namespace std::chrono_literals;
+
+namespace http
+{
+
+namespace asio = boost::asio;
+
+class ClientPool
+    : public std::enable_shared_from_this<ClientPool>
+{
+public:
+    using CreatorType = std::function<std::shared_ptr<Client>(std::string_view host, uint16_t port)>;
+
+    struct Options
+    {
+        std::size_t             maxConnections = 8;
+        std::size_t             maxIdle = 4;
+        std::chrono::seconds    idleTimeout = 30s;
+        std::chrono::seconds    waitTimeout = 10s;
+    };
+
+    // Exclusive handle to a pooled client, returns it to the pool when destroyed
+    class Lease
+    {
+    public:
+        Lease() = default;
+        Lease(Lease&& other) noexcept = default;
+        Lease& operator=(Lease&& other) noexcept;
+        ~Lease();
+
+        Client* operator->() const;
+        Client& operator*() const;
+        explicit operator bool() const;
+
+        void release();
+
+    private:
+        friend class ClientPool;
+
+        Lease(
+            std::shared_ptr<ClientPool> pool,
+            std::string key,
+            std::shared_ptr<Client> client);
+
+    private:
+        std::shared_ptr<ClientPool> _pool;
+        std::string                 _key;
+        std::shared_ptr<Client>     _client;
+    };
+
+public:
+    ClientPool(asio::io_context& ioc, CreatorType creator);
+
+    void setOptions(Options const& options);
+
+    void run();
+
+    // Blocks until a connection to host:port is free, waiters are served in arrival order.
+    // Returns an empty lease if none became free within Options::waitTimeout
+    Lease acquire(std::string_view host, uint16_t port);
+
+    void evict();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Waiter
+    {
+        std::condition_variable     condition;
+        std::shared_ptr<Client>     client;
+    };
+
+    struct Idle
+    {
+        std::shared_ptr<Client>     client;
+        Clock::time_point           since;
+    };
+
+    struct Host
+    {
+        std::size_t                 connections = 0;
+        std::deque<Idle>            idle;
+        std::deque<Waiter*>         waiters;
+    };
+
+    void _release(std::string const& key, std::shared_ptr<Client> client);
+    void _evict(Host& host, Clock::time_point now);
+
+    void _sweep();
+    void _onSweep(beast::error_code ec);
+
+private:
+    static constexpr auto                   _sweepInterval = 1s;
+
+    asio::steady_timer                      _timer;
+    CreatorType                             _creator;
+    Options                                 _options;
+
+    std::mutex                              _mutex;
+    std::unordered_map<std::string, Host>   _hosts;
+};
+
+}
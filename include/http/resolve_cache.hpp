@@ -0,0 +1,82 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/beast.hpp>
+
+using namespace std::chrono_literals;
+
+namespace http
+{
+
+namespace asio  = boost::asio;
+namespace beast = boost::beast;
+
+// Thread-safe cache of host:port lookups shared by all clients of a Factory.
+// The least recently used hosts go first once the cache is full
+class ResolveCache
+{
+public:
+    using Endpoints = std::vector<asio::ip::tcp::endpoint>;
+
+    struct Options
+    {
+        std::chrono::seconds    ttl = 60s;
+        std::chrono::seconds    negativeTtl = 5s;
+        std::size_t             maxEntries = 1024;
+    };
+
+public:
+    void setOptions(Options const& options);
+
+    // Returns true on a hit. A cached failure is reported through ec,
+    // otherwise the endpoints are rotated so that every hit starts with the next address
+    bool lookup(
+        std::string_view host,
+        uint16_t port,
+        Endpoints& endpoints,
+        beast::error_code& ec);
+
+    void store(
+        std::string_view host,
+        uint16_t port,
+        asio::ip::tcp::resolver::results_type const& results);
+    void store(std::string_view host, uint16_t port, beast::error_code const& ec);
+
+    void invalidate(std::string_view host, uint16_t port);
+
+private:
+    using Clock = std::chrono::steady_clock;
+    using Lru = std::list<std::string>;
+
+    struct Entry
+    {
+        Endpoints                   endpoints;
+        beast::error_code           ec;
+        Clock::time_point           expires;
+        std::size_t                 next = 0;
+        Lru::iterator               position;
+    };
+
+    using Entries = std::unordered_map<std::string, Entry>;
+
+    static std::string _key(std::string_view host, uint16_t port);
+
+    void _insert(std::string key, Entry entry);
+    void _erase(Entries::iterator it);
+    void _evict();
+
+private:
+    Options                                 _options;
+
+    std::mutex                              _mutex;
+    Entries                                 _entries;
+    Lru                                     _lru;
+};
+
+}
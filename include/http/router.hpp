@@ -0,0 +1,120 @@
+#pragma once
+
+#include <array>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "message.hpp"
+
+namespace http
+{
+
+// Path parameters of a matched route in pattern order, pointing into the request target
+class Captures
+{
+public:
+    static constexpr std::size_t maxSize = 8;
+
+public:
+    std::size_t size() const { return _size; }
+    std::string_view operator[](std::size_t index) const { return _values[index]; }
+
+    // Empty when the route has no parameter of that name
+    std::string_view operator[](std::string_view name) const
+    {
+        for(std::size_t i = 0; _names && i < _size; ++i) {
+            if((*_names)[i] == name)
+                return _values[i];
+        }
+        return {};
+    }
+
+private:
+    friend class Router;
+
+    std::array<std::string_view, maxSize>   _values;
+    std::size_t                             _size = 0;
+    std::vector<std::string> const*         _names = nullptr;
+};
+
+// Dispatch on method and path. Patterns are made of static text, ":name" segments
+// capturing up to the next '/' and a final "*name" capturing the rest of the path.
+// Routes are compiled into a radix tree once, matching then allocates nothing.
+// Static text wins over a parameter and a parameter over a wildcard
+class Router
+{
+public:
+    using HandlerType = std::function<Response(RequestView const& request, Captures const& captures)>;
+
+    struct Match
+    {
+        HandlerType const*  handler = nullptr;
+        Captures            captures;
+        // Methods of the path when it exists without the requested one, for 405
+        std::string_view    allowed;
+    };
+
+public:
+    Router();
+    ~Router();
+
+    // Fails on malformed patterns and on a pattern already taken for the method
+    bool add(http::verb method, std::string_view pattern, HandlerType handler);
+
+    // Done by Server::setRouter, routes added afterwards need another compile
+    void compile();
+
+    // The query string is not part of the path. HEAD falls back to the GET route
+    Match match(http::verb method, std::string_view target) const;
+
+    // Answers 404 for unknown paths and 405 with Allow for unknown methods
+    Response route(RequestView const& request) const;
+
+private:
+    struct Route
+    {
+        http::verb                  method;
+        HandlerType                 handler;
+        std::vector<std::string>    names;
+    };
+
+    // Node of the tree routes are added to
+    struct Entry;
+
+    // Node of the compiled tree, its label and children are ranges of shared arrays
+    struct Node
+    {
+        uint32_t    label = 0;
+        uint32_t    labelSize = 0;
+        uint32_t    children = 0;
+        uint32_t    childrenSize = 0;
+        int32_t     param = -1;
+        int32_t     wildcard = -1;
+        uint32_t    routes = 0;
+        uint32_t    routesSize = 0;
+        uint32_t    allowed = 0;
+        uint32_t    allowedSize = 0;
+    };
+
+    uint32_t _flatten(Entry const& entry);
+    bool _match(uint32_t index, std::string_view path, http::verb method, Match& match) const;
+    bool _accept(Node const& node, http::verb method, Match& match) const;
+
+private:
+    std::vector<Route>                      _routes;
+    std::unique_ptr<Entry>                  _root;
+
+    std::vector<Node>                       _nodes;
+    std::string                             _labels;
+    // First character of every child next to its index, searched without touching the child
+    std::vector<char>                       _firsts;
+    std::vector<uint32_t>                   _children;
+    std::vector<uint32_t>                   _nodeRoutes;
+    std::string                             _allowed;
+};
+
+}
@@ -1,11 +1,27 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <vector>
 
 #include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
 #include <boost/beast.hpp>
+#include <boost/beast/ssl.hpp>
 
+#include "access_log.hpp"
+#include "compression.hpp"
+#include "file_cache.hpp"
 #include "message.hpp"
+#include "metrics.hpp"
+#include "router.hpp"
+#include "worker_pool.hpp"
+
+using namespace std::chrono_literals;
 
 namespace http
 {
@@ -19,55 +35,300 @@ class Server
 {
 public:
     using CallbackType = std::function<Response(Request const&)>;
+    // Receives a view into the parsed request instead of a copy
+    using ViewCallbackType = std::function<Response(RequestView const&)>;
+    // Decides per request whether the callback runs inline on the io thread
+    using InlineType = std::function<bool(RequestView const&)>;
+
+    // Completes the request of an asynchronous handler, once, from any thread
+    class Responder
+    {
+    public:
+        void send(Response response) const;
+
+    private:
+        friend class Server;
+        struct State;
+
+        std::shared_ptr<State>  _state;
+    };
+
+    // The request stays valid until the responder has sent
+    using AsyncCallbackType = std::function<void(Request const&, Responder)>;
+
+    // Consumer of a streamed request body. The sink gets the body piece by piece on
+    // the io thread, the response is taken from complete once the body has ended.
+    // A sink returning false skips the rest of the body and closes the connection
+    struct BodyStream
+    {
+        SinkType                    sink = nullptr;
+        std::function<Response()>   complete = nullptr;
+    };
+
+    // Called once the header is read, a stream without sink reads the body into memory
+    using StreamCallbackType = std::function<BodyStream(RequestView const& header)>;
+
+    struct Options
+    {
+        std::chrono::seconds    readTimeout = 10s;
+        std::chrono::seconds    writeTimeout = 10s;
+        // Time a kept-alive connection may wait for the next request
+        std::chrono::seconds    idleTimeout = 30s;
+        // Requests served on one connection before it is closed, 0 for no limit
+        std::size_t             maxRequests = 1000;
+        // Pipelined responses queued on one connection before reading is paused
+        std::size_t             pipelineLimit = 8;
+        // Header and body limits, bodies are pre-sized from their Content-Length
+        Limits                  limits;
+        // Largest piece of a streamed request or response body held in memory
+        std::size_t             chunkSize = 64 * 1024;
+        // Level of gzip or deflate for clients accepting it, 1 to 9, 0 sends bodies as they are.
+        // Bodies with an ETag are compressed once and then served from the cache
+        int                     compressionLevel = 0;
+        // Smaller bodies are not worth compressing
+        std::size_t             compressionThreshold = 1024;
+        // Per-connection arena for headers and request state, 0 to use the heap
+        std::size_t             arenaSize = 8192;
+        // One SO_REUSEPORT acceptor per io_context instead of a single shared one
+        bool                    reusePort = false;
+        // Accepts kept outstanding on every acceptor
+        std::size_t             pendingAccepts = 1;
+        // Serve HTTP/2 next to HTTP/1.1 to clients sending its preface right away (h2c)
+        bool                    http2 = false;
+        // Requests a client may have in flight at once on one HTTP/2 connection
+        uint32_t                maxStreams = 100;
+        // A GET of this target answers the metrics set with setMetrics in the Prometheus
+        // text format before any callback or route sees it, empty to serve none
+        std::string             metricsTarget;
+    };
 
 public:
     Server(asio::io_context& ioc);
+    // Accepted connections are spread over the io_contexts round-robin
+    Server(std::vector<asio::io_context*> reactors);
 
     void setup(std::string_view host, uint16_t port);
+    void setOptions(Options const& options);
     void setCallback(CallbackType callback);
+    void setViewCallback(ViewCallbackType callback);
+    // Compiles the routes, requests then go to the router instead of the callbacks
+    void setRouter(std::shared_ptr<Router> router);
+
+    // Handlers answering later through the responder keep no thread busy meanwhile,
+    // without an answer within the deadline the request gets 504
+    void setAsyncCallback(AsyncCallbackType callback, std::chrono::milliseconds deadline = 30s);
+
+    // Requests the stream callback takes have their body streamed instead of buffered
+    void setStreamCallback(StreamCallbackType callback);
+
+    // Open files kept between file responses, the server has its own cache by default
+    void setFileCache(std::shared_ptr<FileCache> cache);
+    void setCompressionCache(std::shared_ptr<CompressionCache> cache);
+
+    // Requests the log samples are recorded once their response is sent
+    void setAccessLog(std::shared_ptr<AccessLog> log);
+
+    // Handler, queue and write timings and counters, none by default as each costs clock
+    // reads on the request path. Set before run, it may be shared by several servers
+    void setMetrics(std::shared_ptr<ServerMetrics> metrics);
+
+    // Run the callback on the worker pool instead of the io thread, except for
+    // requests the inline predicate accepts. A full pool queue answers 503
+    void setWorkerPool(std::shared_ptr<WorkerPool> workers, InlineType inlined = nullptr);
+
+    // Serve HTTPS with the PEM certificate chain and key. Called again while running,
+    // connections accepted from then on get the new pair and open ones keep theirs.
+    // Clients offering h2 through ALPN get HTTP/2 when it is enabled
+    bool setCertificate(std::string_view cert, std::string_view key);
 
     bool run();
 
+
+    static AllocatorStats getAllocatorStats();
+
 private:
-    void _accept();
-    void _onAccept(beast::error_code ec, asio::ip::tcp::socket socket);
+    // Accept completions of one acceptor run one at a time, whatever threads run its io_context
+    using Acceptor = asio::basic_socket_acceptor<asio::ip::tcp, asio::strand<asio::io_context::executor_type>>;
+    using Message = http::response<http::string_body, Fields>;
+    using SslStream = beast::ssl_stream<beast::tcp_stream>;
+    using SslContext = std::shared_ptr<asio::ssl::context>;
+
+    // Part of a file sent after the header of a response
+    struct FilePart
+    {
+        std::shared_ptr<FileCache::File const> file;
+        uint64_t                offset = 0;
+        uint64_t                remaining = 0;
+    };
+
+    bool _listen(Acceptor& acceptor);
+    asio::io_context& _nextReactor();
+
+    void _accept(Acceptor& acceptor);
+    void _onAccept(Acceptor* acceptor, beast::error_code ec, asio::ip::tcp::socket socket);
+
+    SslContext _tlsContext() const;
+    void _countHandshake(SSL* ssl, beast::error_code const& ec, metrics::Clock::time_point start) const;
+    static int _selectProtocol(
+        SSL* ssl, unsigned char const** out, unsigned char* outSize,
+        unsigned char const* in, unsigned int inSize, void* user);
+
+    // Shared by both protocols, the time it takes is recorded
+    Response _handle(RequestView::Message const& request) const;
+    Response _dispatch(RequestView::Message const& request) const;
+    bool _isMetrics(RequestView::Message const& request) const;
+    // Requests go to the async callback, except for the metrics
+    bool _isAsync(RequestView::Message const& request) const;
+    static Request _makeRequest(RequestView::Message const& request);
+    void _compress(RequestView::Message const& request, Message& response) const;
+    FilePart _prepareFile(RequestView::Message const& request, Message& response, std::string const& path) const;
 
 private:
     class Session
         : public std::enable_shared_from_this<Session>
     {
     public:
-        Session(asio::ip::tcp::socket&& socket, CallbackType callback);
+        Session(asio::ip::tcp::socket&& socket, std::shared_ptr<Server const> server);
+        ~Session();
 
         void run();
 
     private:
-        void _onRun();
+        using Parser = http::request_parser<http::string_body, ArenaAllocator<char>>;
+        using BodyParser = http::request_parser<http::buffer_body, ArenaAllocator<char>>;
+        using StreamMessage = http::response<http::buffer_body, Fields>;
+        using Serializer = http::response_serializer<http::buffer_body, Fields>;
+
+        struct Slot
+        {
+            Slot(ArenaAllocator<char> const& allocator);
+
+            RequestView::Message    request;
+            Message                 message;
+            // Sends the body chunked instead of the message body
+            SourceType              source;
+            // Only the header of a streamed body goes out, as the answer to HEAD
+            bool                    headerOnly = false;
+            // Part of a file sent after the header
+            std::shared_ptr<FileCache::File const> file;
+            uint64_t                offset = 0;
+            uint64_t                remaining = 0;
+            // The file behind the source shrank below its announced length
+            bool                    truncated = false;
+            bool                    ready = false;
+            // Handed to the worker pool
+            metrics::Clock::time_point queued;
+            // Set on requests the access log sampled
+            std::optional<AccessLog::Record> log;
+        };
+
+    private:
+        void _handshake();
+        void _onHandshake(beast::error_code ec);
+        void _detect();
+        void _onDetect(beast::error_code ec, std::size_t bytes_transferred);
+        void _read();
+        void _onIdle(beast::error_code ec, std::size_t bytes_transferred);
+        void _readRequest();
+        void _onHeader(beast::error_code ec, std::size_t bytes_transferred);
         void _onRead(beast::error_code ec, std::size_t bytes_transferred);
+        void _readBody();
+        void _onBody(beast::error_code ec, std::size_t bytes_transferred);
+        void _readNext();
+        void _flush();
+        void _writeStream();
+        void _onWriteChunk(beast::error_code ec, std::size_t bytes_transferred);
+        void _writeFile();
+        void _onFileHeader(beast::error_code ec, std::size_t bytes_transferred);
+        void _sendFile();
+        void _onWritable(beast::error_code ec);
         void _onWrite(beast::error_code ec, std::size_t bytes_transferred);
+        void _sent(std::size_t bytes);
+        void _close();
+        void _drain();
 
-        void _processRequest();
+        template<typename Function>
+        void _withStream(Function&& function);
+        beast::tcp_stream& _lowest();
+
+        std::shared_ptr<Slot> _push(RequestView::Message&& request);
+        void _reject(http::status status);
+
+        void _processRequest(std::shared_ptr<Slot> slot);
+        void _processAsync(Request&& req, std::shared_ptr<Slot> slot);
+        void _complete(Slot& slot, Response&& rsp);
 
         void _processError(beast::error_code const& ec, std::string_view msg);
 
     private:
-        static constexpr uint               _version = 11;
         static constexpr uint64_t           _payloadLimit = 1024;
+        // Bytes sent from a file before other handlers get their turn
+        static constexpr uint64_t           _sendfileBurst = 1024 * 1024;
 
+        // Moved into the TLS stream on HTTPS connections, _lowest() is the one in use
         beast::tcp_stream                   _stream;
+        SslContext                          _context;
+        std::unique_ptr<SslStream>          _ssl;
+        asio::steady_timer                  _timer;
+        std::shared_ptr<Arena>              _arena;
         beast::flat_buffer                  _buffer;
-        http::request<http::string_body>    _request;
-        http::response<http::string_body>   _response;
+        std::optional<Parser>               _parser;
+        std::optional<BodyParser>           _bodyParser;
+        BodyStream                          _body;
+        std::vector<char>                   _readChunk;
+        std::optional<StreamMessage>        _streamed;
+        std::optional<Serializer>           _serializer;
+        std::vector<char>                   _writeChunk;
+        std::deque<std::shared_ptr<Slot>>   _queue;
 
-        CallbackType                        _callback = nullptr;
+        std::shared_ptr<Server const>       _server;
+        std::size_t                         _requests = 0;
+        metrics::Clock::time_point          _writeStart;
+        metrics::Clock::time_point          _handshakeStart;
+        // Of the response being written, the header included
+        uint64_t                            _written = 0;
+        // Peer address, only taken when requests are logged
+        asio::ip::address                   _remote;
+        bool                                _reading = false;
+        bool                                _writing = false;
+        bool                                _closing = false;
+        // Unread request bytes may follow, they are drained before the socket closes
+        bool                                _linger = false;
     };
 
+    // Connection that started with the HTTP/2 preface, defined with the protocol code
+    class Http2Session;
+
 private:
-    asio::io_context&       _ioc;
-    asio::ip::tcp::acceptor _acceptor;
-    asio::ip::tcp::endpoint _endpoint;
+    static constexpr auto                   _acceptRetry = 100ms;
+
+    std::vector<asio::io_context*>          _reactors;
+    std::atomic<std::size_t>                _next = 0;
+    std::vector<std::unique_ptr<Acceptor>>  _acceptors;
+    asio::ip::tcp::endpoint                 _endpoint;
+
+    Options                                 _options;
+    CallbackType                            _callback = nullptr;
+    ViewCallbackType                        _viewCallback = nullptr;
+    std::shared_ptr<Router const>           _router;
+    std::shared_ptr<WorkerPool>             _workers;
+    InlineType                              _inline = nullptr;
+
+    AsyncCallbackType                       _asyncCallback = nullptr;
+    std::chrono::milliseconds               _asyncDeadline = 30s;
+
+    StreamCallbackType                      _streamCallback = nullptr;
+    std::shared_ptr<FileCache>              _files;
+    std::shared_ptr<CompressionCache>       _compressed;
+    std::shared_ptr<AccessLog>              _accessLog;
+
+    // Replaced as a whole on reload, sessions hold on to the one they started with
+    mutable std::mutex                      _tlsMutex;
+    SslContext                              _tls;
+    // Shared by all contexts so that tickets issued before a reload still resume
+    std::array<unsigned char, 80>           _ticketKeys{};
 
-    CallbackType            _callback = nullptr;
+    std::shared_ptr<ServerMetrics>          _metrics;
 };
 
 }
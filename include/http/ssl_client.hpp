@@ -1,12 +1,20 @@
 #pragma once
 
+#include <deque>
+#include <future>
+#include <optional>
 #include <string>
+#include <vector>
 
 #include <boost/asio.hpp>
 #include <boost/beast.hpp>
 #include <boost/beast/ssl.hpp>
 
+#include "compression.hpp"
 #include "message.hpp"
+#include "metrics.hpp"
+#include "resolve_cache.hpp"
+#include "tls_session_cache.hpp"
 
 using namespace std::chrono_literals;
 
@@ -25,46 +33,204 @@ public:
 
     void setup(std::string_view host, uint16_t port);
     void setTimeout(std::chrono::seconds timeout);
-
+    // Largest piece of a streamed body held in memory at once
+    void setChunkSize(std::size_t size);
+    // Responses over the limits fail with http::error::header_limit or body_limit
+    void setLimits(Limits const& limits);
+    // Ask for gzip or deflate and decode such responses, on by default.
+    // Streamed responses are never encoded
+    void setDecompression(bool enabled);
+    void setResolveCache(std::shared_ptr<ResolveCache> cache);
+    // Phase timings and counters, shared by any number of clients. None by default
+    void setMetrics(std::shared_ptr<ClientMetrics> metrics);
+    void setSessionCache(std::shared_ptr<TlsSessionCache> cache);
+
+    bool isConnected() const;
+
+    // Blocking calls, must not be made from a thread running the io_context
     bool get(Request const& request, std::string& response);
     bool post(Request const& request, std::string& response);
+    // The response body goes to the sink as it arrives instead of into memory
+    bool get(Request const& request, SinkType sink);
+    bool post(Request const& request, SinkType sink);
+
+    // Non-blocking calls completing with void(beast::error_code, std::string),
+    // usable with callbacks, asio::use_future and asio::use_awaitable
+    template<typename CompletionToken>
+    auto async_get(Request const& request, CompletionToken&& token);
+    template<typename CompletionToken>
+    auto async_post(Request const& request, CompletionToken&& token);
+    // Streaming variants, completing with an empty body once the sink got all of it
+    template<typename CompletionToken>
+    auto async_get(Request const& request, SinkType sink, CompletionToken&& token);
+    template<typename CompletionToken>
+    auto async_post(Request const& request, SinkType sink, CompletionToken&& token);
 
 private:
-    void _createRequest(Request const& request, http::verb method);
+    using RequestType = http::request<http::string_body>;
+    using HandlerType = std::function<void(beast::error_code, std::string)>;
+    using Upload = http::request<http::buffer_body>;
+    using Parser = http::response_parser<http::string_body>;
+    using Download = http::response_parser<http::buffer_body>;
+
+    struct Operation
+    {
+        RequestType     request;
+        SourceType      source;
+        SinkType        sink;
+        HandlerType     handler;
+    };
+
+    RequestType _createRequest(Request const& request, http::verb method) const;
+    Operation _createOperation(Request const& request, http::verb method, SinkType sink = nullptr) const;
+
+    template<typename CompletionToken>
+    auto _async(Operation operation, CompletionToken&& token);
+    template<typename Handler>
+    HandlerType _wrap(Handler&& handler);
+
+    bool _call(Operation operation, std::string& response);
+    void _enqueue(Operation operation);
+    void _complete(beast::error_code const& ec);
 
     void _run();
+    void _resolve();
     void _onResolve(
         beast::error_code ec,
         asio::ip::tcp::resolver::results_type results);
+    void _connect();
     void _onConnect(
         beast::error_code ec,
         asio::ip::tcp::resolver::results_type::endpoint_type endpoint);
     void _onHandshake(beast::error_code ec);
+    void _write();
     void _onWrite(beast::error_code ec, std::size_t bytes_transferred);
+    void _onHeader(beast::error_code ec, std::size_t bytes_transferred);
     void _onRead(beast::error_code ec, std::size_t bytes_transferred);
-    void _onShutdown(beast::error_code ec);
+
+    void _writeStream();
+    void _onWriteChunk(beast::error_code ec, std::size_t bytes_transferred);
+    void _readStream();
+    void _onReadChunk(beast::error_code ec, std::size_t bytes_transferred);
+    void _finish(bool keepAlive);
+
+    void _reconnect();
+    void _close();
+    void _shutdown();
+    bool _isAlive();
+    // Written tells a failure after the whole request was sent
+    bool _canRetry(beast::error_code const& ec, bool written) const;
 
     void _processError(beast::error_code const& ec, std::string_view msg);
 
+    // A phase starts at the mark and ends at the record, which marks the next one
+    void _mark();
+    void _record(Histogram ClientMetrics::* phase);
+
 private:
+    using Stream = beast::ssl_stream<beast::tcp_stream>;
+
     static constexpr auto                       _defaultTimeout = 10s;
     static constexpr auto                       _errorTimeout = 100ms;
     static constexpr uint                       _version = 11;
     static constexpr uint64_t                   _payloadLimit = 2048;
+    static constexpr std::size_t                _defaultChunkSize = 64 * 1024;
 
+    asio::strand<asio::io_context::executor_type> _strand;
+    asio::ssl::context&                         _ctx;
     asio::ip::tcp::resolver                     _resolver;
-    beast::ssl_stream<beast::tcp_stream>        _stream;
+    asio::steady_timer                          _errorTimer;
+    std::shared_ptr<ResolveCache>               _cache;
+    std::shared_ptr<ClientMetrics>              _metrics;
+    metrics::Clock::time_point                  _phase;
+    ResolveCache::Endpoints                     _endpoints;
+    std::shared_ptr<TlsSessionCache>            _sessions;
+    std::shared_ptr<Stream>                     _stream;
     beast::flat_buffer                          _buffer;
-    beast::error_code                           _ec;
-    http::request<http::string_body>            _request;
-    http::response<http::string_body>           _response;
+    std::deque<Operation>                       _queue;
+    RequestType                                 _request;
+    std::optional<Parser>                       _parser;
+    std::optional<Upload>                       _upload;
+    std::optional<http::request_serializer<http::buffer_body>> _serializer;
+    std::optional<Download>                     _download;
+    std::vector<char>                           _chunk;
 
     std::string                                 _host;
     uint16_t                                    _port;
     std::chrono::seconds                        _timeout = _defaultTimeout;
-
-    std::mutex                                  _mutex;
-    std::condition_variable_any                 _condition;
+    std::size_t                                 _chunkSize = _defaultChunkSize;
+    // Responses may carry up to 8 MiB in memory, as beast allows by default
+    Limits                                      _limits{8192, 8 * 1024 * 1024};
+
+    bool                                        _connected = false;
+    bool                                        _reused = false;
+    bool                                        _retried = false;
+    // Part of a streamed body went through, the request cannot be repeated
+    bool                                        _streamed = false;
+    bool                                        _decompression = true;
 };
 
+template<typename CompletionToken>
+auto SslClient::async_get(Request const& request, CompletionToken&& token)
+{
+    return _async(
+        _createOperation(request, http::verb::get),
+        std::forward<CompletionToken>(token));
+}
+
+template<typename CompletionToken>
+auto SslClient::async_post(Request const& request, CompletionToken&& token)
+{
+    return _async(
+        _createOperation(request, http::verb::post),
+        std::forward<CompletionToken>(token));
+}
+
+template<typename CompletionToken>
+auto SslClient::async_get(Request const& request, SinkType sink, CompletionToken&& token)
+{
+    return _async(
+        _createOperation(request, http::verb::get, std::move(sink)),
+        std::forward<CompletionToken>(token));
+}
+
+template<typename CompletionToken>
+auto SslClient::async_post(Request const& request, SinkType sink, CompletionToken&& token)
+{
+    return _async(
+        _createOperation(request, http::verb::post, std::move(sink)),
+        std::forward<CompletionToken>(token));
+}
+
+template<typename CompletionToken>
+auto SslClient::_async(Operation operation, CompletionToken&& token)
+{
+    return asio::async_initiate<CompletionToken, void(beast::error_code, std::string)>(
+        [self = shared_from_this()](auto handler, Operation operation) {
+            operation.handler = self->_wrap(std::move(handler));
+            self->_enqueue(std::move(operation));
+        },
+        token, std::move(operation));
+}
+
+template<typename Handler>
+SslClient::HandlerType SslClient::_wrap(Handler&& handler)
+{
+    // The handler is invoked on its own executor and keeps it busy until then,
+    // it is shared to fit into a copyable std::function
+    auto executor = asio::get_associated_executor(handler, _strand);
+    auto work = std::make_shared<decltype(asio::make_work_guard(executor))>(executor);
+    auto shared = std::make_shared<std::decay_t<Handler>>(std::forward<Handler>(handler));
+
+    return [shared, work](beast::error_code ec, std::string body) {
+        auto executor = work->get_executor();
+        asio::dispatch(
+            executor,
+            [shared, work, ec, body = std::move(body)]() mutable {
+                (*shared)(ec, std::move(body));
+                work->reset();
+            });
+    };
+}
+
 }
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <openssl/ssl.h>
+
+namespace http
+{
+
+// Client-side TLS sessions per host:port, used to resume instead of doing a full handshake
+class TlsSessionCache
+{
+public:
+    struct Stats
+    {
+        uint64_t    full = 0;
+        uint64_t    resumed = 0;
+    };
+
+public:
+    // Returns a new reference to the cached session or nullptr, the caller frees it
+    SSL_SESSION* get(std::string_view host, uint16_t port);
+
+    // Takes over the reference to the session
+    void store(std::string_view host, uint16_t port, SSL_SESSION* session);
+
+    void invalidate(std::string_view host, uint16_t port);
+
+    void countHandshake(bool resumed);
+    Stats stats() const;
+
+private:
+    struct SessionFree
+    {
+        void operator()(SSL_SESSION* session) const { SSL_SESSION_free(session); }
+    };
+
+    using SessionPtr = std::unique_ptr<SSL_SESSION, SessionFree>;
+
+    static std::string _key(std::string_view host, uint16_t port);
+
+private:
+    std::mutex                                      _mutex;
+    std::unordered_map<std::string, SessionPtr>     _sessions;
+
+    std::atomic<uint64_t>                           _full = 0;
+    std::atomic<uint64_t>                           _resumed = 0;
+};
+
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include "header_map.hpp"
+
+namespace http
+{
+
+// Percent-encoding of query strings. Everything but the unreserved characters of
+// RFC 3986 is escaped, '+' decodes to a space as HTML forms send it
+namespace url
+{
+
+// Appends the encoded value, growing the string once
+void encode(std::string_view value, std::string& out);
+
+// Decodes into out, false for a malformed escape
+bool decode(std::string_view value, std::string& out);
+
+// The path followed by the encoded parameters, built in a single allocation
+std::string makeTarget(std::string_view path, ParamMap const& params);
+
+// Adds the decoded parameters of the target's query string
+bool parseQuery(std::string_view target, ParamMap& params);
+
+}
+
+// Lazy view of the query string of a request target. Nothing is parsed up front,
+// lookups scan the raw string and values are decoded only when they are asked for
+class Query
+{
+public:
+    // Takes the whole target, only what follows '?' is looked at
+    explicit Query(std::string_view target);
+
+    bool empty() const { return _query.empty(); }
+
+    bool has(std::string_view key) const;
+
+    // The value as sent, still encoded, pointing into the target. Empty when missing
+    std::string_view raw(std::string_view key) const;
+
+    // The decoded value. It points into the target when nothing needed decoding,
+    // otherwise into the buffer, which callers can reuse between lookups
+    std::string_view get(std::string_view key, std::string& buffer) const;
+
+    // Calls function(key, value) with every raw pair in order
+    template<typename Function>
+    void forEach(Function&& function) const;
+
+private:
+    // Raw pair starting at position, position moves past it
+    bool _next(std::size_t& position, std::string_view& key, std::string_view& value) const;
+
+private:
+    std::string_view    _query;
+};
+
+template<typename Function>
+void Query::forEach(Function&& function) const
+{
+    std::size_t position = 0;
+    std::string_view key;
+    std::string_view value;
+    while(_next(position, key, value))
+        function(key, value);
+}
+
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace http
+{
+
+// Bounded pool of threads running blocking work off the io_context threads
+class WorkerPool
+{
+public:
+    using TaskType = std::function<void()>;
+
+public:
+    WorkerPool(std::size_t threads, std::size_t queueLimit);
+    ~WorkerPool();
+
+    // Returns false without queueing when queueLimit tasks are already waiting
+    bool post(TaskType task);
+
+    std::size_t queued() const;
+
+private:
+    void _run();
+
+private:
+    std::size_t                 _queueLimit;
+
+    mutable std::mutex          _mutex;
+    std::condition_variable     _condition;
+    std::deque<TaskType>        _tasks;
+    bool                        _stop = false;
+
+    std::vector<std::thread>    _threads;
+};
+
+}
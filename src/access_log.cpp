@@ -0,0 +1,239 @@
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+
+#include <boost/beast/http/verb.hpp>
+
+#include <loguru.hpp>
+
+#include "http/access_log.hpp"
+
+namespace http
+{
+
+namespace
+{
+
+// Lines written in one call to the writer, a batch may go slightly beyond
+constexpr std::size_t batchSize = 64 * 1024;
+
+constexpr char const* months[] = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+void appendNumber(std::string& out, uint64_t value)
+{
+    char digits[20];
+    std::size_t size = 0;
+    do {
+        digits[size++] = char('0' + value % 10);
+        value /= 10;
+    } while(value);
+
+    while(size)
+        out += digits[--size];
+}
+
+}
+
+void AccessLog::Record::setTarget(std::string_view value)
+{
+    targetSize = uint8_t(std::min(value.size(), targetCapacity));
+    std::copy_n(value.data(), targetSize, target.data());
+}
+
+void AccessLog::Record::setAddress(boost::asio::ip::address const& value)
+{
+    v4 = value.is_v4();
+    if(v4) {
+        auto bytes = value.to_v4().to_bytes();
+        std::copy(bytes.begin(), bytes.end(), address.begin());
+    }
+    else {
+        address = value.to_v6().to_bytes();
+    }
+}
+
+AccessLog::AccessLog(WriterType writer)
+    : AccessLog(std::move(writer), Options())
+{}
+
+AccessLog::AccessLog(WriterType writer, Options const& options)
+    : _writer(std::move(writer))
+    , _options(options)
+{
+    std::size_t capacity = 2;
+    while(capacity < _options.capacity)
+        capacity *= 2;
+
+    _cells.reset(new Cell[capacity]);
+    _mask = capacity - 1;
+    for(std::size_t i = 0; i < capacity; ++i)
+        _cells[i].sequence.store(i, std::memory_order_relaxed);
+
+    _buffer.reserve(batchSize + 512);
+
+    _thread = std::thread([this]() { _run(); });
+}
+
+AccessLog::~AccessLog()
+{
+    {
+        std::scoped_lock lock(_mutex);
+        _stop = true;
+    }
+    _condition.notify_all();
+
+    _thread.join();
+}
+
+bool AccessLog::sample() const
+{
+    if(_options.sampleRate <= 1)
+        return true;
+
+    thread_local uint32_t counter = 0;
+    return counter++ % _options.sampleRate == 0;
+}
+
+bool AccessLog::push(Record const& record)
+{
+    // Producers claim a cell by moving the head past it, the sequence tells
+    // whether the consumer has already taken what the cell held before
+    auto position = _head.load(std::memory_order_relaxed);
+    Cell* cell;
+    while(true) {
+        cell = &_cells[position & _mask];
+        auto sequence = cell->sequence.load(std::memory_order_acquire);
+        auto difference = intptr_t(sequence) - intptr_t(position);
+
+        if(difference == 0) {
+            if(_head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if(difference < 0) {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        else {
+            position = _head.load(std::memory_order_relaxed);
+        }
+    }
+
+    cell->record = record;
+    cell->sequence.store(position + 1, std::memory_order_release);
+
+    return true;
+}
+
+AccessLog::Stats AccessLog::stats() const
+{
+    Stats stats;
+    stats.logged = _logged.load(std::memory_order_relaxed);
+    stats.dropped = _dropped.load(std::memory_order_relaxed);
+    return stats;
+}
+
+int64_t AccessLog::now()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+void AccessLog::_run()
+{
+    // Producers never wake the thread, an empty ring is polled again after the interval
+    while(true) {
+        if(_drain())
+            continue;
+
+        std::unique_lock lock(_mutex);
+        if(_condition.wait_for(lock, _options.flushInterval, [this]() { return _stop; }))
+            break;
+    }
+
+    while(_drain());
+}
+
+bool AccessLog::_drain()
+{
+    _buffer.clear();
+
+    uint64_t count = 0;
+    while(_buffer.size() < batchSize) {
+        auto& cell = _cells[_tail & _mask];
+        if(cell.sequence.load(std::memory_order_acquire) != _tail + 1)
+            break;
+
+        _format(cell.record);
+        cell.sequence.store(_tail + _mask + 1, std::memory_order_release);
+        ++_tail;
+        ++count;
+    }
+
+    if(!count)
+        return false;
+
+    _logged.fetch_add(count, std::memory_order_relaxed);
+
+    try {
+        _writer(_buffer);
+    }
+    catch(std::exception const& e) {
+        LOG(error) << "Access log: " << e.what();
+    }
+
+    return true;
+}
+
+// Common Log Format, with the microseconds the request took appended:
+// 127.0.0.1 - - [10/Oct/2000:13:55:36 +0000] "GET /index.html HTTP/1.1" 200 2326 154
+void AccessLog::_format(Record const& record)
+{
+    if(record.v4) {
+        boost::asio::ip::address_v4::bytes_type bytes;
+        std::copy_n(record.address.begin(), bytes.size(), bytes.begin());
+        _buffer += boost::asio::ip::address_v4(bytes).to_string();
+    }
+    else {
+        _buffer += boost::asio::ip::address_v6(record.address).to_string();
+    }
+
+    // Records mostly arrive in the same second as the one before
+    auto second = record.time / 1000000;
+    if(second != _second) {
+        std::time_t time = second;
+        std::tm tm;
+        gmtime_r(&time, &tm);
+
+        char date[40];
+        std::snprintf(
+            date, sizeof(date), " - - [%02d/%s/%04d:%02d:%02d:%02d +0000] \"",
+            tm.tm_mday, months[tm.tm_mon], tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
+
+        _second = second;
+        _date = date;
+    }
+    _buffer += _date;
+
+    auto method = boost::beast::http::to_string(boost::beast::http::verb(record.method));
+    _buffer.append(method.data(), method.size());
+    _buffer += ' ';
+    _buffer.append(record.target.data(), record.targetSize);
+    _buffer += " HTTP/";
+    _buffer += char('0' + record.version / 10);
+    _buffer += '.';
+    _buffer += char('0' + record.version % 10);
+    _buffer += "\" ";
+    appendNumber(_buffer, record.status);
+    _buffer += ' ';
+    if(record.bytes)
+        appendNumber(_buffer, record.bytes);
+    else
+        _buffer += '-';
+    _buffer += ' ';
+    appendNumber(_buffer, record.duration);
+    _buffer += '\n';
+}
+
+}
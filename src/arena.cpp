@@ -0,0 +1,164 @@
+#include <cstdint>
+#include <vector>
+
+#include "http/arena.hpp"
+
+namespace http
+{
+
+namespace
+{
+
+struct GlobalStats
+{
+    std::atomic<uint64_t>   arenaAllocations = 0;
+    std::atomic<uint64_t>   arenaBytes = 0;
+    std::atomic<uint64_t>   fallbackAllocations = 0;
+    std::atomic<uint64_t>   fallbackBytes = 0;
+    std::atomic<uint64_t>   arenaResets = 0;
+    std::atomic<uint64_t>   recycled = 0;
+    std::atomic<uint64_t>   fresh = 0;
+};
+
+GlobalStats& globalStats()
+{
+    static GlobalStats stats;
+    return stats;
+}
+
+// Backing blocks of dropped arenas, handed to the next arena of the same size
+struct Blocks
+{
+    std::size_t             size = 0;
+    std::vector<std::byte*> free;
+
+    ~Blocks()
+    {
+        for(auto* block: free)
+            delete[] block;
+    }
+};
+
+Blocks& blocks()
+{
+    static thread_local Blocks blocks;
+    return blocks;
+}
+
+constexpr std::size_t blocksLimit = 1024;
+
+std::byte* takeBlock(std::size_t size)
+{
+    auto& pool = blocks();
+    if(pool.size != size || pool.free.empty()) {
+        Arena::countRecycled(false);
+        return new std::byte[size];
+    }
+
+    Arena::countRecycled(true);
+    auto* block = pool.free.back();
+    pool.free.pop_back();
+    return block;
+}
+
+void giveBlock(std::byte* block, std::size_t size)
+{
+    auto& pool = blocks();
+
+    // Sessions of one server share the arena size, a new size replaces the kept blocks
+    if(pool.size != size) {
+        for(auto* kept: pool.free)
+            delete[] kept;
+        pool.free.clear();
+        pool.size = size;
+    }
+
+    if(pool.free.size() >= blocksLimit) {
+        delete[] block;
+        return;
+    }
+
+    pool.free.push_back(block);
+}
+
+}
+
+Arena::Arena(std::size_t size)
+    : _buffer(size ? takeBlock(size) : nullptr)
+    , _size(size)
+{}
+
+Arena::~Arena()
+{
+    if(_buffer)
+        giveBlock(_buffer.release(), _size);
+
+    auto& stats = globalStats();
+    stats.arenaAllocations += _stats.arenaAllocations;
+    stats.arenaBytes += _stats.arenaBytes;
+    stats.fallbackAllocations += _stats.fallbackAllocations;
+    stats.fallbackBytes += _stats.fallbackBytes;
+    stats.arenaResets += _stats.arenaResets;
+}
+
+void* Arena::allocate(std::size_t size, std::size_t align)
+{
+    // Everything handed out before was returned, start over from the beginning
+    if(_offset && _live.load(std::memory_order_acquire) == 0) {
+        _offset = 0;
+        ++_stats.arenaResets;
+    }
+
+    std::size_t offset = (_offset + align - 1) & ~(align - 1);
+
+    if(offset + size > _size) {
+        ++_stats.fallbackAllocations;
+        _stats.fallbackBytes += size;
+        return ::operator new(size);
+    }
+
+    _offset = offset + size;
+    _live.fetch_add(1, std::memory_order_relaxed);
+
+    ++_stats.arenaAllocations;
+    _stats.arenaBytes += size;
+
+    return _buffer.get() + offset;
+}
+
+void Arena::deallocate(void* p, std::size_t) noexcept
+{
+    auto address = reinterpret_cast<std::uintptr_t>(p);
+    auto begin = reinterpret_cast<std::uintptr_t>(_buffer.get());
+
+    if(address < begin || address >= begin + _size)
+        return ::operator delete(p);
+
+    _live.fetch_sub(1, std::memory_order_release);
+}
+
+AllocatorStats Arena::stats()
+{
+    auto& stats = globalStats();
+
+    AllocatorStats result;
+    result.arenaAllocations = stats.arenaAllocations;
+    result.arenaBytes = stats.arenaBytes;
+    result.fallbackAllocations = stats.fallbackAllocations;
+    result.fallbackBytes = stats.fallbackBytes;
+    result.arenaResets = stats.arenaResets;
+    result.recycled = stats.recycled;
+    result.fresh = stats.fresh;
+    return result;
+}
+
+void Arena::countRecycled(bool recycled)
+{
+    auto& stats = globalStats();
+    if(recycled)
+        stats.recycled.fetch_add(1, std::memory_order_relaxed);
+    else
+        stats.fresh.fetch_add(1, std::memory_order_relaxed);
+}
+
+}
@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <future>
+
+#include "http/batch_client.hpp"
+
+namespace http
+{
+
+// State of one run, completed once and then only waited on by its late calls
+struct BatchClient::Batch
+{
+    Batch(asio::strand<asio::io_context::executor_type> const& strand)
+        : timer(strand)
+    {}
+
+    std::vector<Call>           calls;
+    std::vector<Result>         results;
+    std::vector<bool>           completed;
+    HandlerType                 handler;
+    asio::steady_timer          timer;
+    metrics::Clock::time_point  start;
+    std::size_t                 remaining = 0;
+    std::size_t                 succeeded = 0;
+    std::size_t                 quorum = 0;
+    bool                        done = false;
+};
+
+BatchClient::BatchClient(asio::io_context& ioc, CreatorType creator)
+    : _strand(asio::make_strand(ioc))
+    , _creator(std::move(creator))
+{}
+
+void BatchClient::setOptions(Options const& options)
+{
+    // Ordered with the batches started after it
+    asio::post(
+        _strand,
+        [self = shared_from_this(), options]() {
+            self->_options = options;
+        });
+}
+
+std::vector<BatchClient::Result> BatchClient::run(std::vector<Call> calls)
+{
+    std::promise<std::vector<Result>> promise;
+    auto future = promise.get_future();
+
+    _start(std::move(calls), [&promise](std::vector<Result> results) {
+        promise.set_value(std::move(results));
+    });
+
+    return future.get();
+}
+
+void BatchClient::_start(std::vector<Call>&& calls, HandlerType handler)
+{
+    asio::post(
+        _strand,
+        [self = shared_from_this(), calls = std::move(calls), handler = std::move(handler)]() mutable {
+            auto batch = std::make_shared<Batch>(self->_strand);
+            batch->start = metrics::Clock::now();
+            batch->calls = std::move(calls);
+            batch->results.resize(batch->calls.size());
+            batch->completed.resize(batch->calls.size());
+            batch->handler = std::move(handler);
+            batch->remaining = batch->calls.size();
+            batch->quorum = std::min(self->_options.quorum, batch->calls.size());
+
+            if(batch->calls.empty())
+                return self->_finish(*batch, {});
+
+            if(auto deadline = self->_options.deadline; deadline.count()) {
+                batch->timer.expires_after(deadline);
+                batch->timer.async_wait(
+                    beast::bind_front_handler(
+                        &BatchClient::_onDeadline,
+                        self,
+                        batch));
+            }
+
+            for(std::size_t i = 0; i < batch->calls.size() && !batch->done; ++i) {
+                auto const& call = batch->calls[i];
+                std::string key = call.host + ":" + std::to_string(call.port);
+                self->_issue(self->_hosts[key], key, batch, i);
+            }
+        });
+}
+
+void BatchClient::_issue(Host& host, std::string const& key, BatchPtr const& batch, std::size_t index)
+{
+    if(!host.idle.empty()) {
+        auto client = std::move(host.idle.back());
+        host.idle.pop_back();
+        return _send(std::move(client), key, batch, index);
+    }
+
+    if(host.connections < std::max<std::size_t>(_options.maxPerHost, 1)) {
+        ++host.connections;
+        auto const& call = batch->calls[index];
+        return _send(_creator(call.host, call.port), key, batch, index);
+    }
+
+    host.waiting.emplace_back(batch, index);
+}
+
+void BatchClient::_send(std::shared_ptr<Client> client, std::string const& key, BatchPtr const& batch, std::size_t index)
+{
+    auto const& call = batch->calls[index];
+
+    // The client completes on the strand, its connection goes to the next call from there
+    client->async_request(
+        call.method, call.request,
+        asio::bind_executor(
+            _strand,
+            [self = shared_from_this(), client, key, batch, index](beast::error_code ec, std::string body) {
+                self->_onCall(client, key, batch, index, ec, std::move(body));
+            }));
+}
+
+void BatchClient::_onCall(
+    std::shared_ptr<Client> client, std::string const& key, BatchPtr const& batch, std::size_t index,
+    beast::error_code ec, std::string body)
+{
+    // A finished batch has already given its result for the call
+    if(!batch->done) {
+        auto& result = batch->results[index];
+        result.error = ec;
+        result.body = std::move(body);
+        result.elapsed = std::chrono::duration_cast<std::chrono::microseconds>(metrics::Clock::now() - batch->start);
+        batch->completed[index] = true;
+
+        --batch->remaining;
+        if(!ec)
+            ++batch->succeeded;
+
+        if(batch->remaining == 0 || (batch->quorum && batch->succeeded >= batch->quorum))
+            _finish(*batch, asio::error::operation_aborted);
+    }
+
+    auto& host = _hosts[key];
+    if(!host.waiting.empty()) {
+        auto [next, position] = std::move(host.waiting.front());
+        host.waiting.pop_front();
+        return _send(std::move(client), key, next, position);
+    }
+
+    host.idle.push_back(std::move(client));
+}
+
+void BatchClient::_onDeadline(BatchPtr const& batch, beast::error_code ec)
+{
+    if(ec || batch->done)
+        return;
+
+    _finish(*batch, asio::error::timed_out);
+}
+
+void BatchClient::_finish(Batch& batch, beast::error_code const& pending)
+{
+    batch.done = true;
+    batch.timer.cancel();
+
+    // Calls still waiting for a connection are not sent anymore
+    for(auto& [key, host]: _hosts) {
+        host.waiting.erase(
+            std::remove_if(
+                host.waiting.begin(), host.waiting.end(),
+                [&batch](auto const& waiting) { return waiting.first.get() == &batch; }),
+            host.waiting.end());
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(metrics::Clock::now() - batch.start);
+    for(std::size_t i = 0; i < batch.results.size(); ++i) {
+        if(!batch.completed[i]) {
+            batch.results[i].error = pending;
+            batch.results[i].elapsed = elapsed;
+        }
+    }
+
+    auto handler = std::move(batch.handler);
+    handler(std::move(batch.results));
+}
+
+}
@@ -0,0 +1,273 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
+#include <zlib.h>
+
+#include "http/compression.hpp"
+
+namespace http
+{
+
+namespace
+{
+
+// Deflate state of one thread and encoding, allocated once and reset per body
+class Deflater
+{
+public:
+    Deflater(Encoding encoding)
+    {
+        // Window bits above 15 ask zlib for the gzip wrapper
+        _ok = deflateInit2(
+            &_stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+            encoding == Encoding::gzip ? 15 + 16 : 15,
+            8, Z_DEFAULT_STRATEGY) == Z_OK;
+    }
+
+    ~Deflater()
+    {
+        if(_ok)
+            deflateEnd(&_stream);
+    }
+
+    bool run(std::string_view data, int level, std::string& out)
+    {
+        if(!_ok || deflateReset(&_stream) != Z_OK)
+            return false;
+
+        if(level != _level) {
+            if(deflateParams(&_stream, level, Z_DEFAULT_STRATEGY) != Z_OK)
+                return false;
+            _level = level;
+        }
+
+        out.resize(deflateBound(&_stream, data.size()));
+
+        _stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+        _stream.avail_in = data.size();
+        _stream.next_out = reinterpret_cast<Bytef*>(out.data());
+        _stream.avail_out = out.size();
+
+        // The bound guarantees the whole body fits in one call
+        if(deflate(&_stream, Z_FINISH) != Z_STREAM_END)
+            return false;
+
+        out.resize(_stream.total_out);
+        return true;
+    }
+
+private:
+    z_stream    _stream{};
+    int         _level = Z_DEFAULT_COMPRESSION;
+    bool        _ok = false;
+};
+
+Deflater& deflater(Encoding encoding)
+{
+    static thread_local Deflater gzip(Encoding::gzip);
+    static thread_local Deflater deflate(Encoding::deflate);
+    return encoding == Encoding::gzip ? gzip : deflate;
+}
+
+bool iequals(std::string_view a, std::string_view b)
+{
+    if(a.size() != b.size())
+        return false;
+    for(std::size_t i = 0; i < a.size(); ++i)
+        if(std::tolower((unsigned char)a[i]) != std::tolower((unsigned char)b[i]))
+            return false;
+    return true;
+}
+
+std::string_view trim(std::string_view value)
+{
+    auto first = value.find_first_not_of(" \t");
+    if(first == std::string_view::npos)
+        return {};
+    auto last = value.find_last_not_of(" \t");
+    return value.substr(first, last - first + 1);
+}
+
+}
+
+std::string_view toString(Encoding encoding)
+{
+    switch(encoding) {
+    case Encoding::gzip:
+        return "gzip";
+    case Encoding::deflate:
+        return "deflate";
+    default:
+        return "identity";
+    }
+}
+
+Encoding parseEncoding(std::string_view value)
+{
+    value = trim(value);
+    if(iequals(value, "gzip") || iequals(value, "x-gzip"))
+        return Encoding::gzip;
+    if(iequals(value, "deflate"))
+        return Encoding::deflate;
+    return Encoding::identity;
+}
+
+Encoding negotiate(std::string_view acceptEncoding)
+{
+    Encoding best = Encoding::identity;
+    double quality = 0;
+
+    while(!acceptEncoding.empty()) {
+        auto end = acceptEncoding.find(',');
+        auto item = acceptEncoding.substr(0, end);
+
+        auto semicolon = item.find(';');
+        auto token = trim(item.substr(0, semicolon));
+
+        double q = 1;
+        if(semicolon != std::string_view::npos) {
+            auto param = trim(item.substr(semicolon + 1));
+            if(param.substr(0, 2) == "q=" || param.substr(0, 2) == "Q=")
+                q = std::strtod(std::string(param.substr(2)).c_str(), nullptr);
+        }
+
+        // Equal qualities prefer gzip, which every client decoding deflate also supports
+        Encoding encoding = token == "*" ? Encoding::gzip : parseEncoding(token);
+        if(encoding != Encoding::identity && q > 0
+            && (q > quality || (q == quality && encoding == Encoding::gzip))) {
+            best = encoding;
+            quality = q;
+        }
+
+        if(end == std::string_view::npos)
+            break;
+        acceptEncoding.remove_prefix(end + 1);
+    }
+
+    return best;
+}
+
+bool compress(std::string_view data, Encoding encoding, int level, std::string& out)
+{
+    if(encoding == Encoding::identity)
+        return false;
+
+    return deflater(encoding).run(data, level, out);
+}
+
+bool decompress(std::string_view data, Encoding encoding, uint64_t limit, std::string& out)
+{
+    if(encoding == Encoding::identity)
+        return false;
+
+    z_stream stream{};
+
+    // Automatic header detection takes both the gzip and the zlib wrapper
+    if(inflateInit2(&stream, 15 + 32) != Z_OK)
+        return false;
+
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = data.size();
+
+    out.clear();
+
+    int result = Z_OK;
+    while(result == Z_OK) {
+        std::size_t size = out.size();
+        std::size_t grow = std::max<std::size_t>(data.size() * 4, 16 * 1024);
+        if(size >= limit) {
+            result = Z_BUF_ERROR;
+            break;
+        }
+        out.resize(std::min<uint64_t>(size + grow, limit));
+
+        stream.next_out = reinterpret_cast<Bytef*>(out.data() + size);
+        stream.avail_out = out.size() - size;
+
+        result = inflate(&stream, Z_NO_FLUSH);
+        out.resize(out.size() - stream.avail_out);
+
+        // Out of input before the end of the stream
+        if(result == Z_OK && stream.avail_in == 0 && stream.avail_out != 0)
+            result = Z_DATA_ERROR;
+    }
+
+    inflateEnd(&stream);
+    return result == Z_STREAM_END;
+}
+
+void CompressionCache::setOptions(Options const& options)
+{
+    std::scoped_lock lock(_mutex);
+    _options = options;
+    _evict();
+}
+
+CompressionCache::Body CompressionCache::get(
+    std::string_view target, std::string_view etag, Encoding encoding, int level, std::size_t size)
+{
+    auto key = _key(target, etag, encoding, level);
+
+    std::scoped_lock lock(_mutex);
+
+    auto it = _entries.find(key);
+    if(it == _entries.end() || it->second.source != size)
+        return nullptr;
+
+    _lru.splice(_lru.begin(), _lru, it->second.position);
+    return it->second.body;
+}
+
+void CompressionCache::store(
+    std::string_view target, std::string_view etag, Encoding encoding, int level, std::size_t size, Body body)
+{
+    auto key = _key(target, etag, encoding, level);
+
+    std::scoped_lock lock(_mutex);
+
+    if(body->size() > _options.maxBytes)
+        return;
+
+    // An entry of the same key but another body is replaced
+    if(auto it = _entries.find(key); it != _entries.end()) {
+        if(it->second.source == size)
+            return;
+        _bytes -= it->second.body->size();
+        _lru.erase(it->second.position);
+        _entries.erase(it);
+    }
+
+    _bytes += body->size();
+    _lru.push_front(key);
+    _entries[std::move(key)] = {std::move(body), size, _lru.begin()};
+
+    _evict();
+}
+
+void CompressionCache::clear()
+{
+    std::scoped_lock lock(_mutex);
+    _entries.clear();
+    _lru.clear();
+    _bytes = 0;
+}
+
+std::string CompressionCache::_key(std::string_view target, std::string_view etag, Encoding encoding, int level)
+{
+    // A request target holds no spaces, it cannot run into the tag
+    return std::string(target) + " " + std::string(etag) + "/" + std::string(toString(encoding)) + "/"
+        + std::to_string(level);
+}
+
+void CompressionCache::_evict()
+{
+    while(!_lru.empty() && (_entries.size() > _options.maxEntries || _bytes > _options.maxBytes)) {
+        auto it = _entries.find(_lru.back());
+        _bytes -= it->second.body->size();
+        _entries.erase(it);
+        _lru.pop_back();
+    }
+}
+
+}
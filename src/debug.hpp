@@ -0,0 +1,19 @@
+#pragma once
+
+#include <loguru.hpp>
+
+namespace http
+{
+
+// Messages and bodies are only dumped to the debug log in builds configured with
+// HTTP_DEBUG_MESSAGES, elsewhere not even the verbosity check is left in the hot paths
+#ifdef HTTP_DEBUG_MESSAGES
+constexpr bool debugMessages = true;
+#else
+constexpr bool debugMessages = false;
+#endif
+
+}
+
+// Stands for LOG(debug) where a whole message is written
+#define LOG_MESSAGE if constexpr(!::http::debugMessages) {} else LOG(debug)
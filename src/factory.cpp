@@ -1,8 +1,15 @@
+#include <cstring>
 #include <string>
 
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
 #include <boost/asio.hpp>
 #include <boost/beast/ssl.hpp>
 
+#include <loguru.hpp>
+
 #include "http/factory.hpp"
 
 namespace http
@@ -15,19 +22,47 @@ std::shared_ptr<Factory> Factory::getFactory()
 }
 
 Factory::Factory()
-    : _work(_ioc)
-    , _ctx(boost::asio::ssl::context::tlsv12_client)
+    : Factory(Options{})
+{}
+
+Factory::Factory(Options const& options)
+    : _ctx(boost::asio::ssl::context::tlsv12_client)
+    , _sessionCache(std::make_shared<TlsSessionCache>())
+    , _resolveCache(std::make_shared<ResolveCache>())
 {
     _ctx.set_default_verify_paths();
     _ctx.set_verify_mode(boost::asio::ssl::verify_peer);
 
-    for(int i = 0; i < 2; ++i)
-        _threads.emplace_back(std::thread([this]() { _ioc.run(); }));
+    std::size_t threads = options.threads;
+    if(threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // The hint only tells the scheduler whether it needs to wake other threads, its mutex
+    // stays: callers and worker threads post into these io_contexts from outside
+    std::size_t reactors = options.reactorPerThread ? threads : 1;
+    for(std::size_t i = 0; i < reactors; ++i) {
+        _reactors.push_back(std::make_unique<asio::io_context>(options.reactorPerThread ? 1 : int(threads)));
+        _works.push_back(asio::make_work_guard(*_reactors.back()));
+    }
+
+    _pool = std::make_shared<ClientPool>(
+        *_reactors.front(),
+        [this](std::string_view host, uint16_t port) { return getClient(host, port); });
+    _pool->run();
+
+    for(std::size_t i = 0; i < threads; ++i) {
+        auto& ioc = *_reactors[i % reactors];
+        _threads.emplace_back(std::thread([&ioc]() { ioc.run(); }));
+
+        if(options.pinThreads)
+            _pin(_threads.back(), i);
+    }
 }
 
 Factory::~Factory()
 {
-    _ioc.stop();
+    for(auto& ioc: _reactors)
+        ioc->stop();
 
     for(auto& t: _threads)
         t.join();
@@ -49,23 +84,102 @@ bool Factory::addCertificate(std::string_view cert)
 
 std::shared_ptr<Client> Factory::getClient(std::string_view host, uint16_t port)
 {
-    auto client = std::make_shared<Client>(_ioc);
+    auto client = std::make_shared<Client>(_nextReactor());
     client->setup(host, port);
+    client->setResolveCache(_resolveCache);
+    client->setMetrics(_metrics);
     return client;
 }
 
 std::shared_ptr<SslClient> Factory::getSslClient(std::string_view host, uint16_t port)
 {
-    auto client = std::make_shared<SslClient>(_ioc, _ctx);
+    auto client = std::make_shared<SslClient>(_nextReactor(), _ctx);
+    client->setup(host, port);
+    client->setResolveCache(_resolveCache);
+    client->setMetrics(_metrics);
+    client->setSessionCache(_sessionCache);
+    return client;
+}
+
+std::shared_ptr<Http2Client> Factory::getHttp2Client(std::string_view host, uint16_t port)
+{
+    auto client = std::make_shared<Http2Client>(_nextReactor());
     client->setup(host, port);
+    client->setResolveCache(_resolveCache);
     return client;
 }
 
+std::shared_ptr<Http2Client> Factory::getHttp2SslClient(std::string_view host, uint16_t port)
+{
+    auto client = std::make_shared<Http2Client>(_nextReactor(), _ctx);
+    client->setup(host, port);
+    client->setResolveCache(_resolveCache);
+    client->setSessionCache(_sessionCache);
+    return client;
+}
+
+TlsSessionCache::Stats Factory::getTlsStats() const
+{
+    return _sessionCache->stats();
+}
+
+void Factory::setResolveOptions(ResolveCache::Options const& options)
+{
+    _resolveCache->setOptions(options);
+}
+
+void Factory::setMetrics(std::shared_ptr<ClientMetrics> metrics)
+{
+    _metrics = std::move(metrics);
+}
+
+void Factory::setPoolOptions(ClientPool::Options const& options)
+{
+    _pool->setOptions(options);
+}
+
+ClientPool::Lease Factory::getPooledClient(std::string_view host, uint16_t port)
+{
+    return _pool->acquire(host, port);
+}
+
+std::shared_ptr<BatchClient> Factory::getBatchClient(BatchClient::Options const& options)
+{
+    auto batch = std::make_shared<BatchClient>(
+        _nextReactor(),
+        [this](std::string_view host, uint16_t port) { return getClient(host, port); });
+    batch->setOptions(options);
+    return batch;
+}
+
 std::shared_ptr<Server> Factory::getServer(std::string_view host, uint16_t port)
 {
-    auto server = std::make_shared<Server>(_ioc);
+    std::vector<asio::io_context*> reactors;
+    for(auto& ioc: _reactors)
+        reactors.push_back(ioc.get());
+
+    auto server = std::make_shared<Server>(std::move(reactors));
     server->setup(host, port);
     return server;
 }
 
+asio::io_context& Factory::_nextReactor()
+{
+    return *_reactors[_next++ % _reactors.size()];
+}
+
+void Factory::_pin(std::thread& thread, std::size_t index)
+{
+#ifdef __linux__
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(index % std::max(1u, std::thread::hardware_concurrency()), &cpus);
+
+    if(int rc = pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus))
+        LOG(error) << "Pin thread " << index << ": " << std::strerror(rc);
+#else
+    boost::ignore_unused(thread, index);
+#endif
+}
+
 }
@@ -0,0 +1,146 @@
+#include <cerrno>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "http/file_cache.hpp"
+
+namespace http
+{
+
+FileCache::File::~File()
+{
+    if(fd >= 0)
+        ::close(fd);
+}
+
+void FileCache::setOptions(Options const& options)
+{
+    std::scoped_lock lock(_mutex);
+    _options = options;
+    _evict();
+}
+
+std::shared_ptr<FileCache::File const> FileCache::open(std::string const& path)
+{
+    auto now = Clock::now();
+
+    std::shared_ptr<File const> cached;
+    {
+        std::scoped_lock lock(_mutex);
+
+        auto it = _entries.find(path);
+        if(it != _entries.end()) {
+            auto& entry = it->second;
+            _lru.splice(_lru.begin(), _lru, entry.position);
+            if(now < entry.checked + _options.validity)
+                return entry.file;
+            cached = entry.file;
+        }
+    }
+
+    // Revalidated outside the lock, hits of the other threads do not wait for the file system
+    if(cached) {
+        struct stat st;
+        bool same = ::stat(path.c_str(), &st) == 0
+            && uint64_t(st.st_ino) == cached->inode
+            && uint64_t(st.st_size) == cached->size
+            && st.st_mtime == cached->modified;
+
+        std::scoped_lock lock(_mutex);
+
+        // Still the same file, keep its descriptor
+        auto it = _entries.find(path);
+        if(same) {
+            if(it != _entries.end() && it->second.file == cached)
+                it->second.checked = now;
+            return cached;
+        }
+
+        if(it != _entries.end() && it->second.file == cached)
+            _erase(it);
+    }
+
+    // Opened outside the lock, a concurrent open of the same path only costs a descriptor
+    auto file = _open(path);
+    if(!file)
+        return nullptr;
+
+    std::scoped_lock lock(_mutex);
+    _insert(path, file, now);
+
+    return file;
+}
+
+void FileCache::invalidate(std::string const& path)
+{
+    std::scoped_lock lock(_mutex);
+    if(auto it = _entries.find(path); it != _entries.end())
+        _erase(it);
+}
+
+std::shared_ptr<FileCache::File const> FileCache::_open(std::string const& path)
+{
+    auto file = std::make_shared<File>();
+
+    file->fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(file->fd < 0)
+        return nullptr;
+
+    struct stat st;
+    if(::fstat(file->fd, &st) != 0)
+        return nullptr;
+
+    if(!S_ISREG(st.st_mode)) {
+        errno = S_ISDIR(st.st_mode) ? EISDIR : EACCES;
+        return nullptr;
+    }
+
+    file->size = st.st_size;
+    file->inode = st.st_ino;
+    file->modified = st.st_mtime;
+
+    char etag[48];
+    std::snprintf(
+        etag, sizeof(etag), "\"%llx-%llx\"",
+        (unsigned long long)file->modified,
+        (unsigned long long)file->size);
+    file->etag = etag;
+
+    std::tm tm;
+    char date[32];
+    ::gmtime_r(&file->modified, &tm);
+    std::strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    file->lastModified = date;
+
+    return file;
+}
+
+void FileCache::_insert(std::string const& path, std::shared_ptr<File const> file, Clock::time_point checked)
+{
+    // A concurrent open of the same path got there first, the newer descriptor replaces it
+    if(auto it = _entries.find(path); it != _entries.end())
+        _erase(it);
+
+    _lru.push_front(path);
+    _entries[path] = {std::move(file), checked, _lru.begin()};
+
+    _evict();
+}
+
+void FileCache::_erase(Entries::iterator it)
+{
+    _lru.erase(it->second.position);
+    _entries.erase(it);
+}
+
+void FileCache::_evict()
+{
+    // Files still being sent stay open until their responses are written
+    while(!_lru.empty() && _entries.size() > _options.maxEntries)
+        _erase(_entries.find(_lru.back()));
+}
+
+}
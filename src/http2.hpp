@@ -0,0 +1,63 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include <nghttp2/nghttp2.h>
+
+namespace http
+{
+
+// Pieces of the nghttp2 glue shared by the server and the client side
+namespace h2
+{
+
+// First bytes a client sends on an HTTP/2 connection
+constexpr std::string_view preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+// Protocol identifier offered and selected through ALPN, length-prefixed
+constexpr std::string_view alpn = "\x02h2";
+
+struct SessionDelete
+{
+    void operator()(nghttp2_session* session) const { nghttp2_session_del(session); }
+};
+
+using SessionPtr = std::unique_ptr<nghttp2_session, SessionDelete>;
+
+// The strings must outlive the submit call, which copies them
+inline nghttp2_nv header(std::string_view name, std::string_view value)
+{
+    return {
+        reinterpret_cast<uint8_t*>(const_cast<char*>(name.data())),
+        reinterpret_cast<uint8_t*>(const_cast<char*>(value.data())),
+        name.size(),
+        value.size(),
+        NGHTTP2_NV_FLAG_NONE};
+}
+
+// HTTP/2 field names are lower case, peers reset streams with upper case ones
+inline std::string lowercase(std::string_view name)
+{
+    std::string result(name);
+    std::transform(result.begin(), result.end(), result.begin(), [](char c) { return std::tolower(c); });
+    return result;
+}
+
+// Connection management of HTTP/1.1 is not allowed on an HTTP/2 connection
+inline bool connectionSpecific(std::string_view name)
+{
+    return name == "connection"
+        || name == "keep-alive"
+        || name == "proxy-connection"
+        || name == "transfer-encoding"
+        || name == "upgrade";
+}
+
+}
+
+}
@@ -0,0 +1,771 @@
+#include <cstring>
+#include <limits>
+
+#include <loguru.hpp>
+
+#include "http/http2_client.hpp"
+#include "http/url.hpp"
+
+#include "debug.hpp"
+#include "http2.hpp"
+
+namespace http
+{
+
+namespace
+{
+
+std::string_view view(uint8_t const* data, std::size_t size)
+{
+    return {reinterpret_cast<char const*>(data), size};
+}
+
+}
+
+// Callbacks nghttp2 runs while it parses what the server sent
+struct Http2Client::Callbacks
+{
+    static int onHeader(
+        nghttp2_session* session, nghttp2_frame const* frame,
+        uint8_t const* name, std::size_t nameSize,
+        uint8_t const* value, std::size_t valueSize,
+        uint8_t flags, void* user)
+    {
+        boost::ignore_unused(flags);
+
+        auto self = static_cast<Http2Client*>(user);
+
+        if(frame->hd.type != NGHTTP2_HEADERS)
+            return 0;
+
+        auto id = frame->hd.stream_id;
+        auto operation = static_cast<Operation*>(nghttp2_session_get_stream_user_data(session, id));
+        if(!operation || operation->error)
+            return 0;
+
+        // Sized as SETTINGS_MAX_HEADER_LIST_SIZE counts, with 32 bytes of overhead per field
+        operation->headerSize += nameSize + valueSize + 32;
+        if(operation->headerSize > self->_limits.headerSize) {
+            operation->error = http::error::header_limit;
+            nghttp2_submit_rst_stream(session, NGHTTP2_FLAG_NONE, id, NGHTTP2_CANCEL);
+            return 0;
+        }
+
+        if(view(name, nameSize) == "content-encoding")
+            operation->encoding = view(value, valueSize);
+
+        return 0;
+    }
+
+    static int onData(
+        nghttp2_session* session, uint8_t flags, int32_t id,
+        uint8_t const* data, std::size_t size, void* user)
+    {
+        boost::ignore_unused(flags);
+
+        auto self = static_cast<Http2Client*>(user);
+
+        auto operation = static_cast<Operation*>(nghttp2_session_get_stream_user_data(session, id));
+        if(!operation || operation->error)
+            return 0;
+
+        if(operation->sink) {
+            if(!operation->sink(view(data, size))) {
+                LOG(warning) << "Read: aborted by the sink";
+                operation->error = asio::error::operation_aborted;
+                nghttp2_submit_rst_stream(session, NGHTTP2_FLAG_NONE, id, NGHTTP2_CANCEL);
+            }
+            return 0;
+        }
+
+        if(operation->response.size() + size > self->_limits.bodySize) {
+            operation->error = http::error::body_limit;
+            nghttp2_submit_rst_stream(session, NGHTTP2_FLAG_NONE, id, NGHTTP2_CANCEL);
+            return 0;
+        }
+
+        operation->response.append(reinterpret_cast<char const*>(data), size);
+        return 0;
+    }
+
+    static int onClose(nghttp2_session* session, int32_t id, uint32_t error, void* user)
+    {
+        boost::ignore_unused(session);
+
+        auto self = static_cast<Http2Client*>(user);
+
+        auto it = self->_streams.find(id);
+        if(it == self->_streams.end())
+            return 0;
+
+        auto operation = std::move(it->second);
+        self->_streams.erase(it);
+
+        if(!operation->error && error != NGHTTP2_NO_ERROR) {
+            // Refused streams, including those above the last one of a GOAWAY, were never
+            // processed and go out again on the next connection. A streamed body was drained
+            // by the first attempt and cannot be sent twice
+            if(error == NGHTTP2_REFUSED_STREAM && !operation->retried && !operation->source) {
+                operation->retried = true;
+                operation->sent = 0;
+                operation->headerSize = 0;
+                operation->encoding.clear();
+                operation->response.clear();
+                self->_queue.push_front(std::move(operation));
+                return 0;
+            }
+
+            operation->error = asio::error::connection_reset;
+        }
+
+        self->_done.push_back(std::move(operation));
+        return 0;
+    }
+
+    static ssize_t readBody(
+        nghttp2_session* session, int32_t id, uint8_t* data, std::size_t size,
+        uint32_t* flags, nghttp2_data_source* source, void* user)
+    {
+        boost::ignore_unused(session, id, user);
+
+        auto& operation = *static_cast<Operation*>(source->ptr);
+
+        if(operation.source) {
+            auto n = operation.source(reinterpret_cast<char*>(data), size);
+            if(n == 0)
+                *flags |= NGHTTP2_DATA_FLAG_EOF;
+            return n;
+        }
+
+        auto const& body = operation.body;
+        auto n = std::min(size, body.size() - operation.sent);
+        std::memcpy(data, body.data() + operation.sent, n);
+        operation.sent += n;
+        if(operation.sent == body.size())
+            *flags |= NGHTTP2_DATA_FLAG_EOF;
+        return n;
+    }
+};
+
+void Http2Client::SessionDelete::operator()(nghttp2_session* session) const
+{
+    nghttp2_session_del(session);
+}
+
+Http2Client::Http2Client(asio::io_context& ioc)
+    : _strand(asio::make_strand(ioc))
+    , _resolver(_strand)
+    , _timer(_strand)
+{}
+
+Http2Client::Http2Client(asio::io_context& ioc, asio::ssl::context& ctx)
+    : Http2Client(ioc)
+{
+    _ctx = &ctx;
+}
+
+void Http2Client::setup(std::string_view host, uint16_t port)
+{
+    _host = host;
+    _port = port;
+}
+
+void Http2Client::setTimeout(std::chrono::seconds timeout)
+{
+    _timeout = timeout;
+}
+
+void Http2Client::setResolveCache(std::shared_ptr<ResolveCache> cache)
+{
+    _cache = std::move(cache);
+}
+
+void Http2Client::setSessionCache(std::shared_ptr<TlsSessionCache> cache)
+{
+    _sessions = std::move(cache);
+}
+
+void Http2Client::setLimits(Limits const& limits)
+{
+    _limits = limits;
+}
+
+void Http2Client::setDecompression(bool enabled)
+{
+    _decompression = enabled;
+}
+
+bool Http2Client::isConnected() const
+{
+    return _connected;
+}
+
+bool Http2Client::get(Request const& request, std::string& response)
+{
+    return _call(_createOperation(request, http::verb::get), response);
+}
+
+bool Http2Client::post(Request const& request, std::string& response)
+{
+    return _call(_createOperation(request, http::verb::post), response);
+}
+
+bool Http2Client::get(Request const& request, SinkType sink)
+{
+    std::string response;
+    return _call(_createOperation(request, http::verb::get, std::move(sink)), response);
+}
+
+bool Http2Client::post(Request const& request, SinkType sink)
+{
+    std::string response;
+    return _call(_createOperation(request, http::verb::post, std::move(sink)), response);
+}
+
+bool Http2Client::_call(OperationPtr operation, std::string& response)
+{
+    std::promise<std::pair<beast::error_code, std::string>> promise;
+    auto future = promise.get_future();
+
+    operation->handler = [&promise](beast::error_code ec, std::string body) {
+        promise.set_value({ec, std::move(body)});
+    };
+    _enqueue(std::move(operation));
+
+    auto [ec, body] = future.get();
+    if(ec)
+        return false;
+
+    response = std::move(body);
+    return true;
+}
+
+Http2Client::OperationPtr Http2Client::_createOperation(Request const& request, http::verb method, SinkType sink) const
+{
+    std::string target = url::makeTarget(request.target, request.params);
+
+    auto operation = std::make_unique<Operation>();
+    auto& headers = operation->headers;
+    headers.reserve(request.fields.size() + 7);
+
+    bool secure = _ctx != nullptr;
+    std::string authority = _host;
+    if(_port != (secure ? 443 : 80))
+        authority += ":" + std::to_string(_port);
+
+    headers.emplace_back(":method", std::string(http::to_string(method)));
+    headers.emplace_back(":scheme", secure ? "https" : "http");
+    headers.emplace_back(":authority", std::move(authority));
+    headers.emplace_back(":path", std::move(target));
+    headers.emplace_back("user-agent", BOOST_BEAST_VERSION_STRING);
+
+    bool acceptEncoding = false;
+    for(auto& [key, value]: request.fields) {
+        auto name = h2::lowercase(key);
+        if(h2::connectionSpecific(name))
+            continue;
+        // The authority pseudo-header takes the place of Host
+        if(name == "host") {
+            headers[2].second = value;
+            continue;
+        }
+        acceptEncoding = acceptEncoding || name == "accept-encoding";
+        headers.emplace_back(std::move(name), value);
+    }
+
+    if(_decompression && !sink && !acceptEncoding)
+        headers.emplace_back("accept-encoding", "gzip, deflate");
+
+    if(!request.source && !request.body.empty())
+        headers.emplace_back("content-length", std::to_string(request.body.size()));
+
+    operation->body = request.body;
+    operation->source = request.source;
+    operation->sink = std::move(sink);
+
+    LOG_MESSAGE
+        << headers[0].second << " " << headers[3].second
+        << (request.body.size() < _payloadLimit
+            ? " " + request.body
+            : "");
+
+    return operation;
+}
+
+void Http2Client::_enqueue(OperationPtr operation)
+{
+    asio::post(
+        _strand,
+        [self = shared_from_this(), operation = std::move(operation)]() mutable {
+            self->_queue.push_back(std::move(operation));
+            self->_run();
+        });
+}
+
+void Http2Client::_run()
+{
+    if(!_session) {
+        // Calls arriving meanwhile wait in the queue for the connection
+        if(!_connecting && !_queue.empty()) {
+            _connecting = true;
+            _resolve();
+        }
+        return;
+    }
+
+    // After a GOAWAY the open streams finish, then a new connection takes the queue
+    while(!_queue.empty() && nghttp2_session_check_request_allowed(_session.get())) {
+        auto operation = std::move(_queue.front());
+        _queue.pop_front();
+        _submit(std::move(operation));
+    }
+
+    // Window updates and body frames the flow control released go out without new calls too
+    _write();
+}
+
+void Http2Client::_resolve()
+{
+    ++_generation;
+
+    if(_ctx) {
+        _ssl = std::make_shared<SslStream>(_strand, *_ctx);
+        _tcp.reset();
+
+        auto ssl = _ssl->native_handle();
+
+        // Only h2 is offered, this client does not fall back to HTTP/1.1
+        if(!SSL_set_tlsext_host_name(ssl, _host.data())
+            || SSL_set_alpn_protos(ssl,
+                reinterpret_cast<unsigned char const*>(h2::alpn.data()),
+                h2::alpn.size()) != 0) {
+            beast::error_code ec((int)ERR_get_error(), asio::error::get_ssl_category());
+            return _processError(ec, "Ssl set");
+        }
+    }
+    else {
+        _tcp = std::make_shared<beast::tcp_stream>(_strand);
+        _ssl.reset();
+    }
+
+    if(_cache) {
+        beast::error_code ec;
+        if(_cache->lookup(_host, _port, _endpoints, ec)) {
+            if(ec)
+                return _processError(ec, "Resolve");
+            return _connect();
+        }
+    }
+
+    _resolver.async_resolve(
+        _host.data(),
+        std::to_string(_port).data(),
+        beast::bind_front_handler(
+            &Http2Client::_onResolve,
+            shared_from_this()));
+}
+
+void Http2Client::_onResolve(
+    beast::error_code ec,
+    asio::ip::tcp::resolver::results_type results)
+{
+    if(_cache) {
+        if(ec)
+            _cache->store(_host, _port, ec);
+        else
+            _cache->store(_host, _port, results);
+    }
+
+    if(ec)
+        return _processError(ec, "Resolve");
+
+    _endpoints.clear();
+    for(auto const& result: results)
+        _endpoints.push_back(result.endpoint());
+
+    _connect();
+}
+
+void Http2Client::_connect()
+{
+    _lowest().expires_after(_timeout);
+
+    _lowest().async_connect(
+        _endpoints,
+        beast::bind_front_handler(
+            &Http2Client::_onConnect,
+            shared_from_this()));
+}
+
+void Http2Client::_onConnect(
+    beast::error_code ec,
+    asio::ip::tcp::resolver::results_type::endpoint_type endpoint)
+{
+    boost::ignore_unused(endpoint);
+
+    if(ec) {
+        if(_cache)
+            _cache->invalidate(_host, _port);
+        return _processError(ec, "Connect");
+    }
+
+    beast::error_code nec;
+    _lowest().socket().set_option(asio::ip::tcp::no_delay(true), nec);
+
+    if(!_ssl)
+        return _start();
+
+    if(_sessions) {
+        if(auto session = _sessions->get(_host, _port)) {
+            SSL_set_session(_ssl->native_handle(), session);
+            SSL_SESSION_free(session);
+        }
+    }
+
+    _ssl->async_handshake(
+        asio::ssl::stream_base::client,
+        beast::bind_front_handler(
+            &Http2Client::_onHandshake,
+            shared_from_this()));
+}
+
+void Http2Client::_onHandshake(beast::error_code ec)
+{
+    if(ec) {
+        if(_sessions)
+            _sessions->invalidate(_host, _port);
+        return _processError(ec, "Handshake");
+    }
+
+    auto ssl = _ssl->native_handle();
+
+    unsigned char const* protocol = nullptr;
+    unsigned int size = 0;
+    SSL_get0_alpn_selected(ssl, &protocol, &size);
+    if(std::string_view(reinterpret_cast<char const*>(protocol), size) != h2::alpn.substr(1))
+        return _processError(beast::errc::make_error_code(beast::errc::protocol_not_supported), "Alpn");
+
+    if(_sessions) {
+        _sessions->countHandshake(SSL_session_reused(ssl));
+        _storeSession = !SSL_session_reused(ssl);
+    }
+
+    _start();
+}
+
+void Http2Client::_start()
+{
+    nghttp2_session_callbacks* callbacks;
+    nghttp2_session_callbacks_new(&callbacks);
+    nghttp2_session_callbacks_set_on_header_callback(callbacks, &Callbacks::onHeader);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks, &Callbacks::onData);
+    nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, &Callbacks::onClose);
+
+    nghttp2_session* session = nullptr;
+    nghttp2_session_client_new(&session, callbacks, this);
+    nghttp2_session_callbacks_del(callbacks);
+    _session.reset(session);
+
+    nghttp2_settings_entry settings[] = {
+        {NGHTTP2_SETTINGS_ENABLE_PUSH, 0},
+        {NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, uint32_t(_streamWindow)},
+        {NGHTTP2_SETTINGS_MAX_HEADER_LIST_SIZE, _limits.headerSize},
+    };
+    nghttp2_submit_settings(_session.get(), NGHTTP2_FLAG_NONE, settings, std::size(settings));
+    nghttp2_session_set_local_window_size(_session.get(), NGHTTP2_FLAG_NONE, 0, _connectionWindow);
+
+    // The timer bounds the connection from here on, it sees the read that is always pending
+    _lowest().expires_never();
+
+    _input.resize(_limits.bufferCapacity);
+    _connecting = false;
+    _connected = true;
+    _activity = Clock::now();
+
+    _read();
+    _watch();
+    _run();
+}
+
+void Http2Client::_submit(OperationPtr operation)
+{
+    std::vector<nghttp2_nv> headers;
+    headers.reserve(operation->headers.size());
+    for(auto const& [name, value]: operation->headers)
+        headers.push_back(h2::header(name, value));
+
+    nghttp2_data_provider provider{};
+    provider.source.ptr = operation.get();
+    provider.read_callback = &Callbacks::readBody;
+
+    bool body = operation->source || !operation->body.empty();
+
+    auto id = nghttp2_submit_request(
+        _session.get(), nullptr,
+        headers.data(), headers.size(),
+        body ? &provider : nullptr,
+        operation.get());
+
+    if(id < 0) {
+        LOG(error) << "Submit: " << nghttp2_strerror(id);
+        operation->error = beast::errc::make_error_code(beast::errc::resource_unavailable_try_again);
+        return _complete(std::move(operation));
+    }
+
+    // The first stream after a pause starts the clock again
+    if(_streams.empty())
+        _activity = Clock::now();
+
+    _streams[id] = std::move(operation);
+}
+
+template<typename Function>
+void Http2Client::_withStream(Function&& function)
+{
+    if(_ssl)
+        function(*_ssl, _ssl);
+    else
+        function(*_tcp, _tcp);
+}
+
+beast::tcp_stream& Http2Client::_lowest()
+{
+    return _ssl ? beast::get_lowest_layer(*_ssl) : *_tcp;
+}
+
+void Http2Client::_read()
+{
+    // The stream is held until the read completes, a reconnect may have replaced it by then
+    _withStream([this](auto& stream, auto owner) {
+        stream.async_read_some(
+            asio::buffer(_input),
+            [self = shared_from_this(), owner, generation = _generation](beast::error_code ec, std::size_t n) {
+                self->_onRead(generation, ec, n);
+            });
+    });
+}
+
+void Http2Client::_onRead(std::size_t generation, beast::error_code ec, std::size_t bytes_transferred)
+{
+    if(generation != _generation || !_session)
+        return;
+
+    if(ec) {
+        // A server closing an idle connection is no error, the next call connects again
+        if(!_streams.empty())
+            _processError(ec, "Read");
+        _close();
+        return _run();
+    }
+
+    _activity = Clock::now();
+
+    // TLS 1.3 tickets arrive after the handshake, so the session is taken once data was read
+    if(_storeSession) {
+        _storeSession = false;
+        _sessions->store(_host, _port, SSL_get1_session(_ssl->native_handle()));
+    }
+
+    _receiving = true;
+    auto rv = nghttp2_session_mem_recv(
+        _session.get(),
+        reinterpret_cast<uint8_t const*>(_input.data()),
+        bytes_transferred);
+    _receiving = false;
+
+    _completeAll();
+
+    if(rv < 0) {
+        LOG(error) << "Receive: " << nghttp2_strerror(int(rv));
+        _fail(beast::errc::make_error_code(beast::errc::protocol_error), false);
+        _close();
+        return _run();
+    }
+
+    _run();
+
+    if(_session)
+        _read();
+}
+
+void Http2Client::_write()
+{
+    if(_writing || _receiving || !_session)
+        return;
+
+    _output.clear();
+    while(_output.size() < _writeSize) {
+        uint8_t const* data = nullptr;
+        auto size = nghttp2_session_mem_send(_session.get(), &data);
+        if(size < 0) {
+            LOG(error) << "Send: " << nghttp2_strerror(int(size));
+            _fail(beast::errc::make_error_code(beast::errc::protocol_error), false);
+            _close();
+            return _run();
+        }
+        if(size == 0)
+            break;
+        _output.append(reinterpret_cast<char const*>(data), size);
+    }
+
+    // Streams finished under a GOAWAY, what is left in the queue needs a new connection
+    _completeAll();
+
+    if(_output.empty()) {
+        if(!nghttp2_session_want_read(_session.get()) && !nghttp2_session_want_write(_session.get())) {
+            _close();
+            _run();
+        }
+        return;
+    }
+
+    _writing = true;
+
+    _withStream([this](auto& stream, auto owner) {
+        asio::async_write(
+            stream,
+            asio::buffer(_output),
+            [self = shared_from_this(), owner, generation = _generation](beast::error_code ec, std::size_t n) {
+                self->_onWrite(generation, ec, n);
+            });
+    });
+}
+
+void Http2Client::_onWrite(std::size_t generation, beast::error_code ec, std::size_t bytes_transferred)
+{
+    boost::ignore_unused(bytes_transferred);
+
+    if(generation != _generation || !_session)
+        return;
+
+    _writing = false;
+
+    if(ec) {
+        _processError(ec, "Write");
+        _close();
+        return _run();
+    }
+
+    _activity = Clock::now();
+
+    _write();
+}
+
+void Http2Client::_watch()
+{
+    _timer.expires_at(_activity + _timeout);
+    _timer.async_wait(
+        beast::bind_front_handler(
+            &Http2Client::_onTimer,
+            shared_from_this()));
+}
+
+void Http2Client::_onTimer(beast::error_code ec)
+{
+    if(ec || !_session)
+        return;
+
+    // An idle connection stays open until the server sends it away
+    if(_streams.empty() && !_writing)
+        _activity = Clock::now();
+
+    if(Clock::now() >= _activity + _timeout) {
+        LOG(error) << "Read: " << beast::error_code(beast::error::timeout).message();
+        _fail(beast::error::timeout, false);
+        _close();
+        return _run();
+    }
+
+    _watch();
+}
+
+void Http2Client::_close()
+{
+    if(!_session && !_connecting)
+        return;
+
+    ++_generation;
+    _session.reset();
+    _connecting = false;
+    _connected = false;
+    _writing = false;
+    _timer.cancel();
+
+    // Streams still open are failed by the caller, this only drops the transport
+    if(_ssl || _tcp) {
+        beast::error_code ec;
+        _lowest().socket().shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+        _lowest().close();
+    }
+}
+
+void Http2Client::_complete(OperationPtr operation)
+{
+    auto& response = operation->response;
+
+    if(!operation->error && _decompression && !operation->sink) {
+        auto encoding = parseEncoding(operation->encoding);
+        if(encoding != Encoding::identity) {
+            std::string body;
+            if(decompress(response, encoding, _limits.bodySize, body))
+                response = std::move(body);
+            else
+                operation->error = beast::errc::make_error_code(beast::errc::bad_message);
+        }
+    }
+
+    if(operation->error)
+        LOG(error) << "Stream: " << operation->error.message();
+    else
+        LOG_MESSAGE
+            << operation->headers[3].second << " "
+            << (response.size() < _payloadLimit
+                ? response
+                : "");
+
+    operation->handler(operation->error, operation->error ? std::string() : std::move(response));
+}
+
+void Http2Client::_completeAll()
+{
+    // Handlers run once nghttp2 has returned, they may well start the next call
+    auto done = std::move(_done);
+    _done.clear();
+
+    for(auto& operation: done)
+        _complete(std::move(operation));
+}
+
+void Http2Client::_fail(beast::error_code const& ec, bool queued)
+{
+    auto streams = std::move(_streams);
+    _streams.clear();
+
+    for(auto& [id, operation]: streams) {
+        operation->error = ec;
+        _complete(std::move(operation));
+    }
+
+    if(!queued)
+        return;
+
+    auto queue = std::move(_queue);
+    _queue.clear();
+
+    for(auto& operation: queue) {
+        operation->error = ec;
+        _complete(std::move(operation));
+    }
+}
+
+void Http2Client::_processError(beast::error_code const& ec, std::string_view msg)
+{
+    LOG(error) << msg << ": " << ec.message();
+
+    // Without a connection nothing queued can be sent either
+    bool connecting = _connecting;
+    _close();
+    _fail(ec, connecting);
+}
+
+}
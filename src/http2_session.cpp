@@ -0,0 +1,763 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+
+#include <loguru.hpp>
+
+#include "debug.hpp"
+#include "http2_session.hpp"
+
+namespace http
+{
+
+namespace
+{
+
+std::string_view view(beast::string_view value)
+{
+    return {value.data(), value.size()};
+}
+
+std::string_view view(uint8_t const* data, std::size_t size)
+{
+    return {reinterpret_cast<char const*>(data), size};
+}
+
+}
+
+Server::Http2Session::Http2Session(beast::tcp_stream&& stream, std::shared_ptr<Server const> server)
+    : Http2Session(std::make_unique<beast::tcp_stream>(std::move(stream)), nullptr, std::move(server))
+{}
+
+Server::Http2Session::Http2Session(std::unique_ptr<SslStream> stream, std::shared_ptr<Server const> server)
+    : Http2Session(nullptr, std::move(stream), std::move(server))
+{}
+
+Server::Http2Session::Http2Session(
+    std::unique_ptr<beast::tcp_stream> tcp,
+    std::unique_ptr<SslStream> ssl,
+    std::shared_ptr<Server const> server)
+    : _tcp(std::move(tcp))
+    , _ssl(std::move(ssl))
+    , _timer(_lowest().get_executor())
+    , _input(server->_options.limits.bufferCapacity)
+    , _server(std::move(server))
+{
+    nghttp2_session_callbacks* callbacks;
+    nghttp2_session_callbacks_new(&callbacks);
+    nghttp2_session_callbacks_set_on_begin_headers_callback(callbacks, &Http2Session::_onBeginHeaders);
+    nghttp2_session_callbacks_set_on_header_callback(callbacks, &Http2Session::_onHeader);
+    nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, &Http2Session::_onFrame);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks, &Http2Session::_onData);
+    nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, &Http2Session::_onClose);
+    nghttp2_session_callbacks_set_on_frame_send_callback(callbacks, &Http2Session::_onSent);
+
+    nghttp2_session* session = nullptr;
+    nghttp2_session_server_new(&session, callbacks, this);
+    nghttp2_session_callbacks_del(callbacks);
+
+    _session.reset(session);
+
+    if(_server->_accessLog) {
+        beast::error_code ec;
+        _remote = _lowest().socket().remote_endpoint(ec).address();
+    }
+
+    if(_server->_metrics)
+        _server->_metrics->sessions.add();
+}
+
+Server::Http2Session::~Http2Session()
+{
+    if(_server->_metrics)
+        _server->_metrics->sessions.sub();
+}
+
+void Server::Http2Session::run(std::string_view received)
+{
+    auto const& options = _server->_options;
+
+    // The stream timeouts would apply to the read that is always pending, the timer watches instead
+    _lowest().expires_never();
+
+    nghttp2_settings_entry settings[] = {
+        {NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, options.maxStreams},
+        {NGHTTP2_SETTINGS_MAX_HEADER_LIST_SIZE, options.limits.headerSize},
+    };
+    nghttp2_submit_settings(_session.get(), NGHTTP2_FLAG_NONE, settings, std::size(settings));
+
+    _activity = Clock::now();
+    if(_server->_metrics)
+        _server->_metrics->bytesReceived.add(received.size());
+
+    if(!_receive(received))
+        return _close();
+
+    _write();
+    _read();
+    _watch();
+}
+
+template<typename Function>
+void Server::Http2Session::_withStream(Function&& function)
+{
+    if(_ssl)
+        function(*_ssl);
+    else
+        function(*_tcp);
+}
+
+beast::tcp_stream& Server::Http2Session::_lowest()
+{
+    return _ssl ? beast::get_lowest_layer(*_ssl) : *_tcp;
+}
+
+void Server::Http2Session::_read()
+{
+    if(_closed)
+        return;
+
+    _withStream([this](auto& stream) {
+        stream.async_read_some(
+            asio::buffer(_input),
+            beast::bind_front_handler(
+                &Http2Session::_onRead,
+                shared_from_this()));
+    });
+}
+
+void Server::Http2Session::_onRead(beast::error_code ec, std::size_t bytes_transferred)
+{
+    if(_closed)
+        return;
+
+    if(ec) {
+        if(ec != asio::error::eof && ec != asio::error::operation_aborted)
+            _processError("Read", ec.message());
+        return _close();
+    }
+
+    _activity = Clock::now();
+    if(_server->_metrics)
+        _server->_metrics->bytesReceived.add(bytes_transferred);
+
+    if(!_receive({_input.data(), bytes_transferred}))
+        return _close();
+
+    _write();
+    _read();
+}
+
+bool Server::Http2Session::_receive(std::string_view data)
+{
+    _receiving = true;
+    auto rv = nghttp2_session_mem_recv(
+        _session.get(),
+        reinterpret_cast<uint8_t const*>(data.data()),
+        data.size());
+    _receiving = false;
+
+    if(rv < 0) {
+        _processError("Receive", nghttp2_strerror(int(rv)));
+        return false;
+    }
+
+    return true;
+}
+
+void Server::Http2Session::_write()
+{
+    if(_writing || _receiving || _closed)
+        return;
+
+    // Frames are gathered up to a chunk so that many small responses share one write
+    _output.clear();
+    while(_output.size() < _server->_options.chunkSize) {
+        uint8_t const* data = nullptr;
+        auto size = nghttp2_session_mem_send(_session.get(), &data);
+        if(size < 0) {
+            _processError("Send", nghttp2_strerror(int(size)));
+            return _close();
+        }
+        if(size == 0)
+            break;
+        _output.append(reinterpret_cast<char const*>(data), size);
+    }
+
+    if(_output.empty()) {
+        // Both sides are done after a GOAWAY once the last stream has closed
+        if(!nghttp2_session_want_read(_session.get()) && !nghttp2_session_want_write(_session.get()))
+            _close();
+        return;
+    }
+
+    _writing = true;
+
+    _withStream([this](auto& stream) {
+        asio::async_write(
+            stream,
+            asio::buffer(_output),
+            beast::bind_front_handler(
+                &Http2Session::_onWrite,
+                shared_from_this()));
+    });
+}
+
+void Server::Http2Session::_onWrite(beast::error_code ec, std::size_t bytes_transferred)
+{
+    if(_server->_metrics)
+        _server->_metrics->bytesSent.add(bytes_transferred);
+
+    _writing = false;
+
+    if(_closed)
+        return;
+
+    if(ec) {
+        _processError("Write", ec.message());
+        return _close();
+    }
+
+    _activity = Clock::now();
+
+    _write();
+}
+
+Server::Http2Session::Clock::duration Server::Http2Session::_timeout() const
+{
+    // A write the client does not take is stalled, otherwise the connection may sit idle
+    // between requests or while handlers run, their own deadlines bound those
+    auto const& options = _server->_options;
+    return _writing ? options.writeTimeout : options.idleTimeout;
+}
+
+void Server::Http2Session::_watch()
+{
+    _timer.expires_at(_activity + _timeout());
+    _timer.async_wait(
+        beast::bind_front_handler(
+            &Http2Session::_onTimer,
+            shared_from_this()));
+}
+
+void Server::Http2Session::_onTimer(beast::error_code ec)
+{
+    if(ec || _closed)
+        return;
+
+    // Traffic since the timer was set moves the deadline
+    if(Clock::now() < _activity + _timeout())
+        return _watch();
+
+    // A write the client does not take is stalled
+    if(_writing)
+        return _close();
+
+    // Handlers still running keep the connection, their own deadlines bound them
+    bool waiting = std::any_of(_streams.begin(), _streams.end(), [](auto const& entry) {
+        return entry.second->dispatched && !entry.second->answered;
+    });
+    if(waiting) {
+        _activity = Clock::now();
+        return _watch();
+    }
+
+    // Otherwise the client went quiet, in the middle of a request or between them
+    if(_expired || !_streams.empty())
+        return _close();
+
+    // An idle client learns that no more requests are taken instead of seeing a reset
+    _expired = true;
+    _activity = Clock::now();
+    nghttp2_session_terminate_session(_session.get(), NGHTTP2_NO_ERROR);
+    _write();
+
+    _watch();
+}
+
+void Server::Http2Session::_close()
+{
+    if(_closed)
+        return;
+
+    _closed = true;
+    _timer.cancel();
+
+    beast::error_code ec;
+    _lowest().socket().shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+    _lowest().close();
+
+    // Handlers still running find their stream gone
+    _streams.clear();
+}
+
+Server::Http2Session::StreamPtr Server::Http2Session::_find(int32_t id) const
+{
+    auto it = _streams.find(id);
+    return it == _streams.end() ? nullptr : it->second;
+}
+
+int Server::Http2Session::_onBeginHeaders(nghttp2_session* session, nghttp2_frame const* frame, void* user)
+{
+    auto self = static_cast<Http2Session*>(user);
+
+    if(frame->hd.type != NGHTTP2_HEADERS || frame->headers.cat != NGHTTP2_HCAT_REQUEST)
+        return 0;
+
+    auto stream = std::make_shared<Stream>();
+    stream->request.version(20);
+    self->_streams[frame->hd.stream_id] = std::move(stream);
+
+    // A connection serves as many requests as a kept-alive one does, then the client moves on
+    auto maxRequests = self->_server->_options.maxRequests;
+    if(++self->_requests == maxRequests)
+        nghttp2_submit_goaway(session, NGHTTP2_FLAG_NONE, frame->hd.stream_id, NGHTTP2_NO_ERROR, nullptr, 0);
+
+    return 0;
+}
+
+int Server::Http2Session::_onHeader(
+    nghttp2_session* session, nghttp2_frame const* frame,
+    uint8_t const* name, std::size_t nameSize,
+    uint8_t const* value, std::size_t valueSize,
+    uint8_t flags, void* user)
+{
+    boost::ignore_unused(session, flags);
+
+    auto self = static_cast<Http2Session*>(user);
+
+    // Trailers are not passed on
+    if(frame->hd.type != NGHTTP2_HEADERS || frame->headers.cat != NGHTTP2_HCAT_REQUEST)
+        return 0;
+
+    auto stream = self->_find(frame->hd.stream_id);
+    if(!stream || stream->headerTooLarge)
+        return 0;
+
+    // Sized as SETTINGS_MAX_HEADER_LIST_SIZE counts, with 32 bytes of overhead per field
+    stream->headerSize += nameSize + valueSize + 32;
+    if(stream->headerSize > self->_server->_options.limits.headerSize) {
+        stream->headerTooLarge = true;
+        return 0;
+    }
+
+    auto key = view(name, nameSize);
+    auto field = view(value, valueSize);
+    auto& request = stream->request;
+
+    if(key == ":method")
+        request.method_string({field.data(), field.size()});
+    else if(key == ":path")
+        request.target({field.data(), field.size()});
+    else if(key == ":authority")
+        request.set(http::field::host, {field.data(), field.size()});
+    else if(key[0] != ':')
+        request.insert({key.data(), key.size()}, {field.data(), field.size()});
+
+    return 0;
+}
+
+int Server::Http2Session::_onFrame(nghttp2_session* session, nghttp2_frame const* frame, void* user)
+{
+    boost::ignore_unused(session);
+
+    auto self = static_cast<Http2Session*>(user);
+
+    if(frame->hd.type != NGHTTP2_HEADERS && frame->hd.type != NGHTTP2_DATA)
+        return 0;
+
+    auto id = frame->hd.stream_id;
+    auto stream = self->_find(id);
+    if(!stream)
+        return 0;
+
+    // Handlers run from here, nothing they throw may unwind through nghttp2
+    try {
+        if(frame->hd.type == NGHTTP2_HEADERS && frame->headers.cat == NGHTTP2_HCAT_REQUEST)
+            self->_onRequest(id, stream);
+
+        if(frame->hd.flags & NGHTTP2_FLAG_END_STREAM)
+            self->_process(id, stream);
+    }
+    catch(std::exception const& e) {
+        self->_fail(id, stream, e);
+    }
+
+    return 0;
+}
+
+int Server::Http2Session::_onData(
+    nghttp2_session* session, uint8_t flags, int32_t id,
+    uint8_t const* data, std::size_t size, void* user)
+{
+    boost::ignore_unused(session, flags);
+
+    auto self = static_cast<Http2Session*>(user);
+
+    auto stream = self->_find(id);
+    if(!stream || stream->answered)
+        return 0;
+
+    if(auto const& sink = stream->body.sink) {
+        try {
+            if(!sink(view(data, size))) {
+                auto complete = std::move(stream->body.complete);
+                stream->body = {};
+                stream->refused = true;
+                self->_complete(id, stream, complete ? complete() : Response());
+            }
+        }
+        catch(std::exception const& e) {
+            self->_fail(id, stream, e);
+        }
+        return 0;
+    }
+
+    auto& body = stream->request.body();
+    if(body.size() + size > self->_server->_options.limits.bodySize) {
+        self->_reject(id, stream, http::status::payload_too_large);
+        return 0;
+    }
+
+    body.append(reinterpret_cast<char const*>(data), size);
+    return 0;
+}
+
+int Server::Http2Session::_onClose(nghttp2_session* session, int32_t id, uint32_t error, void* user)
+{
+    boost::ignore_unused(session, error);
+
+    auto self = static_cast<Http2Session*>(user);
+
+    // Closed once the response is sent, or reset by either side
+    if(auto stream = self->_find(id); stream && stream->log && stream->answered) {
+        auto& record = *stream->log;
+        record.status = uint16_t(stream->message.result_int());
+        record.bytes = stream->sent;
+        record.duration = uint32_t(AccessLog::now() - record.time);
+        self->_server->_accessLog->push(record);
+    }
+
+    self->_streams.erase(id);
+
+    return 0;
+}
+
+int Server::Http2Session::_onSent(nghttp2_session* session, nghttp2_frame const* frame, void* user)
+{
+    auto self = static_cast<Http2Session*>(user);
+
+    if(frame->hd.type != NGHTTP2_HEADERS && frame->hd.type != NGHTTP2_DATA)
+        return 0;
+    if(!(frame->hd.flags & NGHTTP2_FLAG_END_STREAM))
+        return 0;
+
+    // The response is complete, a client still sending the body is told to stop without error
+    auto id = frame->hd.stream_id;
+    if(auto stream = self->_find(id); stream && stream->refused && !nghttp2_session_get_stream_remote_close(session, id))
+        nghttp2_submit_rst_stream(session, NGHTTP2_FLAG_NONE, id, NGHTTP2_NO_ERROR);
+
+    return 0;
+}
+
+ssize_t Server::Http2Session::_readBody(
+    nghttp2_session* session, int32_t id, uint8_t* data, std::size_t size,
+    uint32_t* flags, nghttp2_data_source* source, void* user)
+{
+    boost::ignore_unused(session, user);
+
+    auto& stream = *static_cast<Stream*>(source->ptr);
+
+    if(auto& part = stream.file; part.file) {
+        ssize_t n;
+        do {
+            n = ::pread(part.file->fd, data, std::min<uint64_t>(size, part.remaining), part.offset);
+        } while(n < 0 && errno == EINTR);
+
+        // The file shrank below its announced length, the stream is reset
+        if(n <= 0)
+            return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+
+        part.offset += n;
+        part.remaining -= n;
+        stream.sent += n;
+        if(part.remaining == 0) {
+            part.file.reset();
+            *flags |= NGHTTP2_DATA_FLAG_EOF;
+        }
+        return n;
+    }
+
+    if(stream.source) {
+        // A throwing source resets its stream, the others go on
+        std::size_t n;
+        try {
+            n = stream.source(reinterpret_cast<char*>(data), size);
+        }
+        catch(std::exception const& e) {
+            LOG(error) << "Source: stream " << id << ": " << e.what();
+            return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+        }
+        stream.sent += n;
+        if(n == 0)
+            *flags |= NGHTTP2_DATA_FLAG_EOF;
+        return n;
+    }
+
+    auto const& body = stream.message.body();
+    auto n = std::min(size, body.size() - stream.sent);
+    std::memcpy(data, body.data() + stream.sent, n);
+    stream.sent += n;
+    if(stream.sent == body.size())
+        *flags |= NGHTTP2_DATA_FLAG_EOF;
+    return n;
+}
+
+void Server::Http2Session::_onRequest(int32_t id, StreamPtr const& stream)
+{
+    if(stream->headerTooLarge)
+        return _reject(id, stream, http::status::request_header_fields_too_large);
+
+    if(auto const& callback = _server->_streamCallback)
+        stream->body = callback(RequestView(stream->request));
+}
+
+void Server::Http2Session::_process(int32_t id, StreamPtr stream)
+{
+    if(stream->answered)
+        return;
+
+    stream->dispatched = true;
+
+    if(_server->_metrics)
+        _server->_metrics->requests.add();
+
+    if(auto const& log = _server->_accessLog; log && log->sample()) {
+        auto& record = stream->log.emplace();
+        record.time = AccessLog::now();
+        record.method = uint16_t(stream->request.method());
+        record.version = 20;
+        record.setTarget(view(stream->request.target()));
+        record.setAddress(_remote);
+    }
+
+    LOG_MESSAGE
+        << stream->request.base()
+        << (stream->request.payload_size() < _payloadLimit
+            ? stream->request.body()
+            : "");
+
+    // The body went to the sink, the response comes from the stream
+    if(stream->body.sink) {
+        auto complete = std::move(stream->body.complete);
+        stream->body = {};
+        return _complete(id, stream, complete ? complete() : Response());
+    }
+
+    if(_server->_isAsync(stream->request)) {
+        Request req = _makeRequest(stream->request);
+        return _processAsync(id, std::move(stream), std::move(req));
+    }
+
+    auto const& workers = _server->_workers;
+    auto const& inlined = _server->_inline;
+
+    if(workers && !(inlined && inlined(RequestView(stream->request)))) {
+        // Streams of one connection run on the workers side by side
+        if(_server->_metrics)
+            stream->queued = metrics::Clock::now();
+        bool posted = workers->post(
+            [self = shared_from_this(), id, stream]() {
+                if(self->_server->_metrics)
+                    self->_server->_metrics->queue.record(stream->queued);
+
+                // A throwing handler still answers, else the stream would wait forever
+                Response rsp;
+                try {
+                    rsp = self->_server->_handle(stream->request);
+                }
+                catch(std::exception const& e) {
+                    LOG(error) << "Handler: " << e.what();
+                    rsp = Response();
+                    rsp.result = http::status::internal_server_error;
+                }
+
+                asio::post(
+                    self->_lowest().get_executor(),
+                    [self, id, stream, rsp = std::move(rsp)]() mutable {
+                        self->_complete(id, stream, std::move(rsp));
+                    });
+            });
+
+        if(!posted) {
+            Response rsp;
+            rsp.result = http::status::service_unavailable;
+            rsp.fields["retry-after"] = "1";
+            _complete(id, stream, std::move(rsp));
+        }
+        return;
+    }
+
+    _complete(id, stream, _server->_handle(stream->request));
+}
+
+void Server::Http2Session::_processAsync(int32_t id, StreamPtr stream, Request&& req)
+{
+    // The stream waits for the responder or the deadline, whichever comes first completes it
+    auto timer = std::make_shared<asio::steady_timer>(_lowest().get_executor());
+
+    // The handler time runs until the responder sends
+    auto start = _server->_metrics ? metrics::Clock::now() : metrics::Clock::time_point();
+
+    auto state = std::make_shared<Responder::State>();
+    state->request = std::move(req);
+    state->complete = [self = shared_from_this(), id, stream, timer, start](Response&& rsp) {
+        if(self->_server->_metrics)
+            self->_server->_metrics->handler.record(start);
+
+        asio::post(
+            self->_lowest().get_executor(),
+            [self, id, stream, timer, rsp = std::move(rsp)]() mutable {
+                timer->cancel();
+                self->_complete(id, stream, std::move(rsp));
+            });
+    };
+
+    timer->expires_after(_server->_asyncDeadline);
+    timer->async_wait(
+        [self = shared_from_this(), id, stream, state](beast::error_code ec) {
+            if(ec || state->done.exchange(true))
+                return;
+
+            Response rsp;
+            rsp.result = http::status::gateway_timeout;
+            self->_complete(id, stream, std::move(rsp));
+        });
+
+    Responder responder;
+    responder._state = state;
+
+    _server->_asyncCallback(state->request, std::move(responder));
+}
+
+void Server::Http2Session::_reject(int32_t id, StreamPtr const& stream, http::status status)
+{
+    LOG(warning) << "Read: stream " << id << " rejected with " << unsigned(status);
+
+    // Whatever the client still sends of the request is not read
+    stream->refused = true;
+
+    Response rsp;
+    rsp.result = status;
+    _complete(id, stream, std::move(rsp));
+}
+
+void Server::Http2Session::_fail(int32_t id, StreamPtr const& stream, std::exception const& e)
+{
+    LOG(error) << "Handler: stream " << id << ": " << e.what();
+
+    // A response already on its way cannot turn into a 500, the stream is reset instead
+    if(stream->answered) {
+        nghttp2_submit_rst_stream(_session.get(), NGHTTP2_FLAG_NONE, id, NGHTTP2_INTERNAL_ERROR);
+        return;
+    }
+
+    Response rsp;
+    rsp.result = http::status::internal_server_error;
+    _complete(id, stream, std::move(rsp));
+}
+
+void Server::Http2Session::_complete(int32_t id, StreamPtr const& stream, Response&& rsp)
+{
+    // The client may have reset the stream while its handler was running
+    if(_closed || _find(id) != stream || stream->answered)
+        return;
+
+    stream->answered = true;
+
+    auto& request = stream->request;
+    auto& response = stream->message;
+    response.version(20);
+    response.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+
+    response.result(rsp.result);
+
+    for(auto& [key, value]: rsp.fields)
+        response.set(key, value);
+
+    if(!rsp.file.empty()) {
+        stream->file = _server->_prepareFile(request, response, rsp.file);
+    }
+    else if(rsp.source) {
+        // Frames delimit the body, it needs neither a length nor chunking
+        stream->source = std::move(rsp.source);
+    }
+    else {
+        response.body() = std::move(rsp.body);
+        _server->_compress(request, response);
+        response.prepare_payload();
+    }
+
+    auto status = response.result_int();
+    stream->bodyless = request.method() == http::verb::head
+        || status < 200 || status == 204 || status == 304;
+
+    // The request is not needed anymore while the response is sent
+    request = {};
+
+    LOG_MESSAGE
+        << response.base()
+        << (response.payload_size() < _payloadLimit
+            ? response.body()
+            : "");
+
+    _submit(id, *stream);
+    _write();
+}
+
+void Server::Http2Session::_submit(int32_t id, Stream& stream)
+{
+    auto const& response = stream.message;
+
+    auto status = std::to_string(response.result_int());
+    auto count = std::distance(response.begin(), response.end());
+
+    // Names are stored before the headers point into them, the reserve keeps them in place
+    std::vector<std::string> names;
+    names.reserve(count);
+    std::vector<nghttp2_nv> headers;
+    headers.reserve(count + 1);
+
+    headers.push_back(h2::header(":status", status));
+    for(auto const& field: response) {
+        auto name = h2::lowercase(view(field.name_string()));
+        if(h2::connectionSpecific(name))
+            continue;
+        names.push_back(std::move(name));
+        headers.push_back(h2::header(names.back(), view(field.value())));
+    }
+
+    bool body = !stream.bodyless
+        && (stream.file.file || stream.source || !response.body().empty());
+
+    nghttp2_data_provider provider{};
+    provider.source.ptr = &stream;
+    provider.read_callback = &Http2Session::_readBody;
+
+    int rv = nghttp2_submit_response(
+        _session.get(), id,
+        headers.data(), headers.size(),
+        body ? &provider : nullptr);
+
+    if(rv != 0)
+        _processError("Submit", nghttp2_strerror(rv));
+}
+
+void Server::Http2Session::_processError(std::string_view msg, std::string_view error)
+{
+    LOG(error) << msg << ": " << error;
+}
+
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "http/server.hpp"
+
+#include "http2.hpp"
+
+namespace http
+{
+
+// Completion of an asynchronous handler, shared by the sessions of both protocols
+struct Server::Responder::State
+{
+    Request                             request;
+    std::function<void(Response&&)>     complete;
+    std::atomic<bool>                   done = false;
+};
+
+// HTTP/2 connection of a Server. Every request arrives on its own stream and is
+// dispatched as soon as it is complete, responses go out in whatever order the
+// handlers finish, interleaved by the flow control of nghttp2
+class Server::Http2Session
+    : public std::enable_shared_from_this<Http2Session>
+{
+public:
+    Http2Session(beast::tcp_stream&& stream, std::shared_ptr<Server const> server);
+    // Takes over a connection that chose h2 through ALPN
+    Http2Session(std::unique_ptr<SslStream> stream, std::shared_ptr<Server const> server);
+    ~Http2Session();
+
+    // Takes the bytes read while the protocol was detected, the preface included
+    void run(std::string_view received);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Stream
+    {
+        RequestView::Message    request;
+        std::size_t             headerSize = 0;
+        bool                    headerTooLarge = false;
+        BodyStream              body;
+        // The response went out before the request ended, the rest of it is discarded
+        bool                    answered = false;
+        bool                    bodyless = false;
+        // The request is complete and went to its handler
+        bool                    dispatched = false;
+        // Answered before the client finished its body, the rest is refused once the response is out
+        bool                    refused = false;
+        // Handed to the worker pool
+        metrics::Clock::time_point queued;
+
+        Message                 message;
+        // The response body comes from the message, a file part or a source,
+        // bytes of it handed to nghttp2 are counted whichever it is
+        std::size_t             sent = 0;
+        FilePart                file;
+        SourceType              source;
+        // Set on requests the access log sampled
+        std::optional<AccessLog::Record> log;
+    };
+
+    using StreamPtr = std::shared_ptr<Stream>;
+
+    Http2Session(
+        std::unique_ptr<beast::tcp_stream> tcp,
+        std::unique_ptr<SslStream> ssl,
+        std::shared_ptr<Server const> server);
+
+    static int _onBeginHeaders(nghttp2_session* session, nghttp2_frame const* frame, void* user);
+    static int _onHeader(
+        nghttp2_session* session, nghttp2_frame const* frame,
+        uint8_t const* name, std::size_t nameSize,
+        uint8_t const* value, std::size_t valueSize,
+        uint8_t flags, void* user);
+    static int _onFrame(nghttp2_session* session, nghttp2_frame const* frame, void* user);
+    static int _onData(
+        nghttp2_session* session, uint8_t flags, int32_t id,
+        uint8_t const* data, std::size_t size, void* user);
+    static int _onClose(nghttp2_session* session, int32_t id, uint32_t error, void* user);
+    static int _onSent(nghttp2_session* session, nghttp2_frame const* frame, void* user);
+    static ssize_t _readBody(
+        nghttp2_session* session, int32_t id, uint8_t* data, std::size_t size,
+        uint32_t* flags, nghttp2_data_source* source, void* user);
+
+    template<typename Function>
+    void _withStream(Function&& function);
+    beast::tcp_stream& _lowest();
+
+    void _read();
+    void _onRead(beast::error_code ec, std::size_t bytes_transferred);
+    bool _receive(std::string_view data);
+    void _write();
+    void _onWrite(beast::error_code ec, std::size_t bytes_transferred);
+    Clock::duration _timeout() const;
+    void _watch();
+    void _onTimer(beast::error_code ec);
+    void _close();
+
+    StreamPtr _find(int32_t id) const;
+    void _onRequest(int32_t id, StreamPtr const& stream);
+    void _process(int32_t id, StreamPtr stream);
+    void _processAsync(int32_t id, StreamPtr stream, Request&& req);
+    void _reject(int32_t id, StreamPtr const& stream, http::status status);
+    // Answers 500 for a handler that threw inside an nghttp2 callback
+    void _fail(int32_t id, StreamPtr const& stream, std::exception const& e);
+    void _complete(int32_t id, StreamPtr const& stream, Response&& rsp);
+    void _submit(int32_t id, Stream& stream);
+
+    void _processError(std::string_view msg, std::string_view error);
+
+private:
+    static constexpr uint64_t               _payloadLimit = 1024;
+
+    // One of them is set
+    std::unique_ptr<beast::tcp_stream>      _tcp;
+    std::unique_ptr<SslStream>              _ssl;
+    asio::steady_timer                      _timer;
+    h2::SessionPtr                          _session;
+    std::unordered_map<int32_t, StreamPtr>  _streams;
+    std::vector<char>                       _input;
+    std::string                             _output;
+
+    std::shared_ptr<Server const>           _server;
+    std::size_t                             _requests = 0;
+    Clock::time_point                       _activity;
+    // Peer address, only taken when requests are logged
+    asio::ip::address                       _remote;
+    // Frames are queued while nghttp2 runs callbacks and sent once it returns
+    bool                                    _receiving = false;
+    bool                                    _writing = false;
+    bool                                    _expired = false;
+    bool                                    _closed = false;
+};
+
+}
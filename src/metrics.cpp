@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <cstdio>
+
+#include "http/metrics.hpp"
+
+namespace http
+{
+
+namespace
+{
+
+constexpr double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+void writeHeader(std::string& out, std::string_view prefix, std::string_view name, char const* type, char const* help)
+{
+    out.append("# HELP ").append(prefix).append("_").append(name).append(" ").append(help).append("\n");
+    out.append("# TYPE ").append(prefix).append("_").append(name).append(" ").append(type).append("\n");
+}
+
+void writeValue(std::string& out, std::string_view prefix, std::string_view name, std::string_view labels, double value)
+{
+    char number[32];
+    std::snprintf(number, sizeof(number), "%.9g", value);
+    out.append(prefix).append("_").append(name).append(labels).append(" ").append(number).append("\n");
+}
+
+void writeCounter(std::string& out, std::string_view prefix, std::string_view name, char const* help, Counter const& counter)
+{
+    writeHeader(out, prefix, name, "counter", help);
+    writeValue(out, prefix, name, {}, double(counter.value()));
+}
+
+void writeGauge(std::string& out, std::string_view prefix, std::string_view name, char const* help, Gauge const& gauge)
+{
+    writeHeader(out, prefix, name, "gauge", help);
+    writeValue(out, prefix, name, {}, double(gauge.value()));
+}
+
+// Microseconds go out as seconds, quantiles are taken from the buckets
+void writeSummary(std::string& out, std::string_view prefix, std::string_view name, char const* help, Histogram const& histogram)
+{
+    auto snapshot = histogram.snapshot();
+
+    std::string metric(name);
+    metric += "_seconds";
+    writeHeader(out, prefix, metric, "summary", help);
+
+    for(auto quantile: quantiles) {
+        char labels[32];
+        std::snprintf(labels, sizeof(labels), "{quantile=\"%g\"}", quantile);
+        writeValue(out, prefix, metric, labels, double(snapshot.percentile(quantile)) / 1e6);
+    }
+    writeValue(out, prefix, metric + "_sum", {}, double(snapshot.sum) / 1e6);
+    writeValue(out, prefix, metric + "_count", {}, double(snapshot.count));
+}
+
+}
+
+Histogram::Histogram()
+    : _shards(metrics::shards)
+{}
+
+Histogram::Snapshot Histogram::snapshot() const
+{
+    Snapshot snapshot;
+    snapshot.counts.resize(_size);
+
+    for(auto const& shard: _shards) {
+        for(std::size_t i = 0; i < _size; ++i)
+            snapshot.counts[i] += shard.counts[i].load(std::memory_order_relaxed);
+        snapshot.sum += shard.sum.load(std::memory_order_relaxed);
+        snapshot.max = std::max(snapshot.max, shard.max.load(std::memory_order_relaxed));
+    }
+
+    for(auto count: snapshot.counts)
+        snapshot.count += count;
+
+    return snapshot;
+}
+
+uint64_t Histogram::Snapshot::percentile(double fraction) const
+{
+    if(count == 0)
+        return 0;
+
+    auto rank = std::max<uint64_t>(uint64_t(fraction * double(count) + 0.5), 1);
+
+    uint64_t seen = 0;
+    for(std::size_t i = 0; i < counts.size(); ++i) {
+        seen += counts[i];
+        if(seen >= rank)
+            return std::min(_highest(i), max);
+    }
+
+    return max;
+}
+
+uint64_t Histogram::_highest(std::size_t index)
+{
+    if(index < 2 * _subCount)
+        return index;
+
+    unsigned shift = unsigned(index / _subCount) - 1;
+    uint64_t sub = index % _subCount + _subCount;
+    return ((sub + 1) << shift) - 1;
+}
+
+std::string ClientMetrics::prometheus(std::string_view prefix) const
+{
+    std::string out;
+
+    writeSummary(out, prefix, "resolve", "Time resolving the host name", resolve);
+    writeSummary(out, prefix, "connect", "Time establishing the TCP connection", connect);
+    writeSummary(out, prefix, "handshake", "Time of the TLS handshake", handshake);
+    writeSummary(out, prefix, "write", "Time writing the request", write);
+    writeSummary(out, prefix, "first_byte", "Time from the request written to the response header read", firstByte);
+    writeSummary(out, prefix, "read", "Time reading the response body", read);
+
+    writeCounter(out, prefix, "requests_total", "Requests started", requests);
+    writeCounter(out, prefix, "errors_total", "Requests failed", errors);
+    writeCounter(out, prefix, "sent_bytes_total", "Bytes of requests written", bytesSent);
+    writeCounter(out, prefix, "received_bytes_total", "Bytes of responses read", bytesReceived);
+    writeGauge(out, prefix, "connections", "Connections open", connections);
+
+    return out;
+}
+
+std::string ServerMetrics::prometheus(std::string_view prefix) const
+{
+    std::string out;
+
+    writeSummary(out, prefix, "queue", "Time waiting for a worker", queue);
+    writeSummary(out, prefix, "handler", "Time in the handler", handler);
+    writeSummary(out, prefix, "write", "Time writing the response", write);
+    writeSummary(out, prefix, "handshake", "Time of the TLS handshake", handshake);
+
+    writeCounter(out, prefix, "accepted_total", "Connections accepted", accepted);
+    writeCounter(out, prefix, "handshakes_full_total", "TLS handshakes with a full key exchange", handshakesFull);
+    writeCounter(out, prefix, "handshakes_resumed_total", "TLS handshakes resuming a session", handshakesResumed);
+    writeCounter(out, prefix, "handshakes_failed_total", "TLS handshakes failed", handshakesFailed);
+    writeCounter(out, prefix, "requests_total", "Requests read", requests);
+    writeCounter(out, prefix, "received_bytes_total", "Bytes of requests read", bytesReceived);
+    writeCounter(out, prefix, "sent_bytes_total", "Bytes of responses written", bytesSent);
+    writeGauge(out, prefix, "sessions", "Connections being served", sessions);
+
+    return out;
+}
+
+}
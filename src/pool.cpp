@@ -0,0 +1,177 @@
+#include <loguru.hpp>
+
+#include "http/pool.hpp"
+
+namespace http
+{
+
+ClientPool::Lease::Lease(
+    std::shared_ptr<ClientPool> pool,
+    std::string key,
+    std::shared_ptr<Client> client)
+    : _pool(std::move(pool))
+    , _key(std::move(key))
+    , _client(std::move(client))
+{}
+
+ClientPool::Lease& ClientPool::Lease::operator=(Lease&& other) noexcept
+{
+    if(this != &other) {
+        release();
+        _pool = std::move(other._pool);
+        _key = std::move(other._key);
+        _client = std::move(other._client);
+    }
+    return *this;
+}
+
+ClientPool::Lease::~Lease()
+{
+    release();
+}
+
+Client* ClientPool::Lease::operator->() const
+{
+    return _client.get();
+}
+
+Client& ClientPool::Lease::operator*() const
+{
+    return *_client;
+}
+
+ClientPool::Lease::operator bool() const
+{
+    return _client != nullptr;
+}
+
+void ClientPool::Lease::release()
+{
+    if(_pool && _client)
+        _pool->_release(_key, std::move(_client));
+
+    _pool.reset();
+    _client.reset();
+}
+
+
+ClientPool::ClientPool(asio::io_context& ioc, CreatorType creator)
+    : _timer(ioc)
+    , _creator(std::move(creator))
+{}
+
+void ClientPool::setOptions(Options const& options)
+{
+    std::scoped_lock lock(_mutex);
+    _options = options;
+}
+
+void ClientPool::run()
+{
+    _sweep();
+}
+
+ClientPool::Lease ClientPool::acquire(std::string_view host, uint16_t port)
+{
+    std::string key = std::string(host) + ":" + std::to_string(port);
+
+    std::unique_lock lock(_mutex);
+
+    auto& entry = _hosts[key];
+    _evict(entry, Clock::now());
+
+    // Nobody is queued before us, so an idle or a new connection can be taken right away
+    if(entry.waiters.empty()) {
+        if(!entry.idle.empty()) {
+            // The most recently used connection is the most likely to be still open
+            auto client = std::move(entry.idle.back().client);
+            entry.idle.pop_back();
+            return Lease(shared_from_this(), std::move(key), std::move(client));
+        }
+
+        if(entry.connections < _options.maxConnections) {
+            ++entry.connections;
+            lock.unlock();
+            return Lease(shared_from_this(), std::move(key), _creator(host, port));
+        }
+    }
+
+    Waiter waiter;
+    entry.waiters.push_back(&waiter);
+
+    bool ready = waiter.condition.wait_for(
+        lock,
+        _options.waitTimeout,
+        [&waiter]() { return waiter.client != nullptr; });
+
+    if(!ready) {
+        auto& waiters = _hosts[key].waiters;
+        waiters.erase(std::find(waiters.begin(), waiters.end(), &waiter));
+        LOG(error) << "Pool: no free connection to " << key;
+        return {};
+    }
+
+    return Lease(shared_from_this(), std::move(key), std::move(waiter.client));
+}
+
+void ClientPool::evict()
+{
+    std::scoped_lock lock(_mutex);
+
+    auto now = Clock::now();
+    for(auto& [key, host]: _hosts)
+        _evict(host, now);
+}
+
+void ClientPool::_release(std::string const& key, std::shared_ptr<Client> client)
+{
+    std::scoped_lock lock(_mutex);
+
+    auto& host = _hosts[key];
+
+    // Hand the connection over to the longest waiting caller
+    if(!host.waiters.empty()) {
+        auto waiter = host.waiters.front();
+        host.waiters.pop_front();
+        waiter->client = std::move(client);
+        waiter->condition.notify_one();
+        return;
+    }
+
+    if(client->isConnected() && host.idle.size() < _options.maxIdle) {
+        host.idle.push_back({std::move(client), Clock::now()});
+        return;
+    }
+
+    --host.connections;
+}
+
+void ClientPool::_evict(Host& host, Clock::time_point now)
+{
+    // Idle connections are ordered by release time, the oldest are in front
+    while(!host.idle.empty() && now - host.idle.front().since >= _options.idleTimeout) {
+        host.idle.pop_front();
+        --host.connections;
+    }
+}
+
+void ClientPool::_sweep()
+{
+    _timer.expires_after(_sweepInterval);
+    _timer.async_wait(
+        [weak = weak_from_this()](beast::error_code ec) {
+            if(auto self = weak.lock())
+                self->_onSweep(ec);
+        });
+}
+
+void ClientPool::_onSweep(beast::error_code ec)
+{
+    if(ec)
+        return;
+
+    evict();
+    _sweep();
+}
+
+}
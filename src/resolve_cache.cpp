@@ -0,0 +1,115 @@
+#include "http/resolve_cache.hpp"
+
+namespace http
+{
+
+void ResolveCache::setOptions(Options const& options)
+{
+    std::scoped_lock lock(_mutex);
+    _options = options;
+    _evict();
+}
+
+bool ResolveCache::lookup(
+    std::string_view host,
+    uint16_t port,
+    Endpoints& endpoints,
+    beast::error_code& ec)
+{
+    auto key = _key(host, port);
+
+    std::scoped_lock lock(_mutex);
+
+    auto it = _entries.find(key);
+    if(it == _entries.end())
+        return false;
+
+    auto& entry = it->second;
+    if(Clock::now() >= entry.expires) {
+        _erase(it);
+        return false;
+    }
+
+    _lru.splice(_lru.begin(), _lru, entry.position);
+
+    if(entry.ec) {
+        ec = entry.ec;
+        return true;
+    }
+
+    auto first = entry.next++ % entry.endpoints.size();
+
+    endpoints.clear();
+    endpoints.reserve(entry.endpoints.size());
+    endpoints.insert(endpoints.end(), entry.endpoints.begin() + first, entry.endpoints.end());
+    endpoints.insert(endpoints.end(), entry.endpoints.begin(), entry.endpoints.begin() + first);
+
+    return true;
+}
+
+void ResolveCache::store(
+    std::string_view host,
+    uint16_t port,
+    asio::ip::tcp::resolver::results_type const& results)
+{
+    if(results.empty())
+        return;
+
+    Entry entry;
+    for(auto const& result: results)
+        entry.endpoints.push_back(result.endpoint());
+
+    std::scoped_lock lock(_mutex);
+    entry.expires = Clock::now() + _options.ttl;
+    _insert(_key(host, port), std::move(entry));
+}
+
+void ResolveCache::store(std::string_view host, uint16_t port, beast::error_code const& ec)
+{
+    Entry entry;
+    entry.ec = ec;
+
+    std::scoped_lock lock(_mutex);
+    entry.expires = Clock::now() + _options.negativeTtl;
+    _insert(_key(host, port), std::move(entry));
+}
+
+void ResolveCache::invalidate(std::string_view host, uint16_t port)
+{
+    auto key = _key(host, port);
+
+    std::scoped_lock lock(_mutex);
+    if(auto it = _entries.find(key); it != _entries.end())
+        _erase(it);
+}
+
+std::string ResolveCache::_key(std::string_view host, uint16_t port)
+{
+    return std::string(host) + ":" + std::to_string(port);
+}
+
+void ResolveCache::_insert(std::string key, Entry entry)
+{
+    if(auto it = _entries.find(key); it != _entries.end())
+        _erase(it);
+
+    _lru.push_front(key);
+    entry.position = _lru.begin();
+    _entries[std::move(key)] = std::move(entry);
+
+    _evict();
+}
+
+void ResolveCache::_erase(Entries::iterator it)
+{
+    _lru.erase(it->second.position);
+    _entries.erase(it);
+}
+
+void ResolveCache::_evict()
+{
+    while(!_lru.empty() && _entries.size() > _options.maxEntries)
+        _erase(_entries.find(_lru.back()));
+}
+
+}
@@ -0,0 +1,298 @@
+#include <algorithm>
+
+#include <loguru.hpp>
+
+#include "http/router.hpp"
+
+namespace http
+{
+
+struct Router::Entry
+{
+    std::string                             label;
+    // Static continuations, no two share their first character
+    std::vector<std::unique_ptr<Entry>>     children;
+    std::unique_ptr<Entry>                  param;
+    std::unique_ptr<Entry>                  wildcard;
+    std::vector<uint32_t>                   routes;
+};
+
+namespace
+{
+
+// Walks the static text down the tree, splitting labels where it parts from them
+template<typename EntryType>
+EntryType* insertStatic(EntryType* entry, std::string_view text)
+{
+    while(!text.empty()) {
+        auto it = std::find_if(
+            entry->children.begin(), entry->children.end(),
+            [&](auto const& child) { return child->label[0] == text[0]; });
+
+        if(it == entry->children.end()) {
+            entry->children.push_back(std::make_unique<EntryType>());
+            entry->children.back()->label = std::string(text);
+            return entry->children.back().get();
+        }
+
+        auto& child = *it;
+        auto common = std::mismatch(child->label.begin(), child->label.end(), text.begin(), text.end()).first
+            - child->label.begin();
+
+        if(std::size_t(common) < child->label.size()) {
+            auto split = std::make_unique<EntryType>();
+            split->label = child->label.substr(0, common);
+            child->label.erase(0, common);
+            split->children.push_back(std::move(child));
+            child = std::move(split);
+        }
+
+        entry = child.get();
+        text.remove_prefix(common);
+    }
+
+    return entry;
+}
+
+}
+
+Router::Router()
+    : _root(std::make_unique<Entry>())
+{}
+
+Router::~Router() = default;
+
+bool Router::add(http::verb method, std::string_view pattern, HandlerType handler)
+{
+    auto processError = [pattern](std::string_view msg) -> bool {
+        LOG(error) << "Route " << pattern << ": " << msg;
+        return false;
+    };
+
+    if(pattern.empty() || pattern[0] != '/')
+        return processError("does not start with /");
+
+    Route route{method, std::move(handler), {}};
+    Entry* entry = _root.get();
+
+    std::size_t position = 0;
+    while(position < pattern.size()) {
+        char c = pattern[position];
+        bool segmentStart = position > 0 && pattern[position - 1] == '/';
+
+        if(segmentStart && c == ':') {
+            auto end = std::min(pattern.find('/', position), pattern.size());
+            if(end == position + 1)
+                return processError("parameter without a name");
+
+            route.names.emplace_back(pattern.substr(position + 1, end - position - 1));
+            if(!entry->param)
+                entry->param = std::make_unique<Entry>();
+            entry = entry->param.get();
+            position = end;
+        }
+        else if(segmentStart && c == '*') {
+            if(pattern.find('/', position) != std::string_view::npos)
+                return processError("wildcard before the end");
+
+            route.names.emplace_back(pattern.substr(position + 1));
+            if(!entry->wildcard)
+                entry->wildcard = std::make_unique<Entry>();
+            entry = entry->wildcard.get();
+            position = pattern.size();
+        }
+        else {
+            // Static text runs up to the next parameter or wildcard
+            auto end = position + 1;
+            while(end < pattern.size()
+                && !(pattern[end - 1] == '/' && (pattern[end] == ':' || pattern[end] == '*')))
+                ++end;
+
+            entry = insertStatic(entry, pattern.substr(position, end - position));
+            position = end;
+        }
+
+        if(route.names.size() > Captures::maxSize)
+            return processError("too many parameters");
+    }
+
+    for(auto index: entry->routes) {
+        if(_routes[index].method == method)
+            return processError("taken for the method");
+    }
+
+    entry->routes.push_back(uint32_t(_routes.size()));
+    _routes.push_back(std::move(route));
+
+    return true;
+}
+
+void Router::compile()
+{
+    _nodes.clear();
+    _labels.clear();
+    _firsts.clear();
+    _children.clear();
+    _nodeRoutes.clear();
+    _allowed.clear();
+
+    _flatten(*_root);
+}
+
+uint32_t Router::_flatten(Entry const& entry)
+{
+    // Children are appended after their parent, the parent is written last
+    auto index = uint32_t(_nodes.size());
+    _nodes.emplace_back();
+
+    Node node;
+    node.label = uint32_t(_labels.size());
+    node.labelSize = uint32_t(entry.label.size());
+    _labels += entry.label;
+
+    node.routes = uint32_t(_nodeRoutes.size());
+    node.routesSize = uint32_t(entry.routes.size());
+    _nodeRoutes.insert(_nodeRoutes.end(), entry.routes.begin(), entry.routes.end());
+
+    // The Allow value of a 405 is ready before any request asks for it
+    std::string allowed;
+    bool get = false;
+    bool head = false;
+    for(auto route: entry.routes) {
+        auto method = _routes[route].method;
+        get = get || method == http::verb::get;
+        head = head || method == http::verb::head;
+        if(!allowed.empty())
+            allowed += ", ";
+        auto name = http::to_string(method);
+        allowed.append(name.data(), name.size());
+    }
+    if(get && !head)
+        allowed += ", HEAD";
+
+    node.allowed = uint32_t(_allowed.size());
+    node.allowedSize = uint32_t(allowed.size());
+    _allowed += allowed;
+
+    std::vector<Entry const*> children;
+    for(auto const& child: entry.children)
+        children.push_back(child.get());
+    std::sort(children.begin(), children.end(), [](auto a, auto b) { return a->label[0] < b->label[0]; });
+
+    node.children = uint32_t(_children.size());
+    node.childrenSize = uint32_t(children.size());
+    _children.resize(_children.size() + children.size());
+    _firsts.resize(_firsts.size() + children.size());
+
+    for(std::size_t i = 0; i < children.size(); ++i) {
+        _firsts[node.children + i] = children[i]->label[0];
+        _children[node.children + i] = _flatten(*children[i]);
+    }
+
+    if(entry.param)
+        node.param = int32_t(_flatten(*entry.param));
+    if(entry.wildcard)
+        node.wildcard = int32_t(_flatten(*entry.wildcard));
+
+    _nodes[index] = node;
+    return index;
+}
+
+Router::Match Router::match(http::verb method, std::string_view target) const
+{
+    Match match;
+    if(!_nodes.empty())
+        _match(0, target.substr(0, target.find('?')), method, match);
+    return match;
+}
+
+bool Router::_match(uint32_t index, std::string_view path, http::verb method, Match& match) const
+{
+    auto const& node = _nodes[index];
+
+    std::string_view label(_labels.data() + node.label, node.labelSize);
+    if(path.substr(0, label.size()) != label)
+        return false;
+    path.remove_prefix(label.size());
+
+    if(path.empty() && _accept(node, method, match))
+        return true;
+
+    if(!path.empty() && node.childrenSize) {
+        auto begin = _firsts.begin() + node.children;
+        auto end = begin + node.childrenSize;
+        auto it = std::lower_bound(begin, end, path[0]);
+        if(it != end && *it == path[0]
+            && _match(_children[node.children + (it - begin)], path, method, match))
+            return true;
+    }
+
+    // Whatever a deeper node captured was undone when it failed
+    auto& captures = match.captures;
+
+    if(node.param >= 0 && !path.empty() && path[0] != '/') {
+        auto value = path.substr(0, path.find('/'));
+        captures._values[captures._size++] = value;
+        if(_match(uint32_t(node.param), path.substr(value.size()), method, match))
+            return true;
+        --captures._size;
+    }
+
+    if(node.wildcard >= 0) {
+        captures._values[captures._size++] = path;
+        if(_accept(_nodes[node.wildcard], method, match))
+            return true;
+        --captures._size;
+    }
+
+    return false;
+}
+
+bool Router::_accept(Node const& node, http::verb method, Match& match) const
+{
+    if(node.routesSize == 0)
+        return false;
+
+    Route const* found = nullptr;
+    Route const* get = nullptr;
+    for(uint32_t i = 0; i < node.routesSize; ++i) {
+        auto const& route = _routes[_nodeRoutes[node.routes + i]];
+        if(route.method == method)
+            found = &route;
+        else if(route.method == http::verb::get)
+            get = &route;
+    }
+
+    if(!found && method == http::verb::head)
+        found = get;
+
+    if(!found) {
+        // A later alternative may still have the method, the first path found names the allowed ones
+        if(match.allowed.empty())
+            match.allowed = std::string_view(_allowed.data() + node.allowed, node.allowedSize);
+        return false;
+    }
+
+    match.handler = &found->handler;
+    match.captures._names = &found->names;
+    return true;
+}
+
+Response Router::route(RequestView const& request) const
+{
+    auto match = this->match(request.method(), request.target());
+    if(match.handler)
+        return (*match.handler)(request, match.captures);
+
+    Response rsp;
+    if(match.allowed.empty()) {
+        rsp.result = http::status::not_found;
+    }
+    else {
+        rsp.result = http::status::method_not_allowed;
+        rsp.fields["allow"] = std::string(match.allowed);
+    }
+    return rsp;
+}
+
+}
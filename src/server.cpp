@@ -1,13 +1,193 @@
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <limits>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#include <unistd.h>
+
+#include <openssl/rand.h>
+
 #include <loguru.hpp>
 
 #include "http/server.hpp"
 
+#include "debug.hpp"
+#include "http2_session.hpp"
+
 namespace http
 {
 
+namespace
+{
+
+// Read buffers of closed sessions, kept with their capacity for the next ones
+std::vector<beast::flat_buffer>& buffers()
+{
+    static thread_local std::vector<beast::flat_buffer> buffers;
+    return buffers;
+}
+
+constexpr std::size_t buffersLimit = 256;
+
+beast::flat_buffer takeBuffer()
+{
+    auto& pool = buffers();
+    if(pool.empty()) {
+        Arena::countRecycled(false);
+        return {};
+    }
+
+    Arena::countRecycled(true);
+    auto buffer = std::move(pool.back());
+    pool.pop_back();
+    return buffer;
+}
+
+// Buffers grown past the configured capacity by a large request are not kept
+void giveBuffer(beast::flat_buffer&& buffer, std::size_t capacity)
+{
+    auto& pool = buffers();
+    if(pool.size() >= buffersLimit || buffer.capacity() > capacity)
+        return;
+
+    buffer.clear();
+    pool.push_back(std::move(buffer));
+}
+
+std::optional<std::time_t> parseDate(std::string_view value)
+{
+    std::tm tm{};
+    std::string date(value);
+    if(!::strptime(date.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm))
+        return std::nullopt;
+    return ::timegm(&tm);
+}
+
+// If-None-Match holds "*" or a list of entity tags, weak ones compare equal too
+bool matchesEtag(std::string_view list, std::string_view etag)
+{
+    if(list == "*")
+        return true;
+
+    while(!list.empty()) {
+        auto end = list.find(',');
+        auto tag = list.substr(0, end);
+
+        tag.remove_prefix(std::min(tag.find_first_not_of(' '), tag.size()));
+        if(tag.substr(0, 2) == "W/")
+            tag.remove_prefix(2);
+        tag = tag.substr(0, tag.find_last_not_of(' ') + 1);
+
+        if(tag == etag)
+            return true;
+
+        if(end == std::string_view::npos)
+            break;
+        list.remove_prefix(end + 1);
+    }
+
+    return false;
+}
+
+// Binary formats are mostly compressed already
+bool compressible(std::string_view type)
+{
+    return type.empty()
+        || type.substr(0, 5) == "text/"
+        || type.find("json") != std::string_view::npos
+        || type.find("xml") != std::string_view::npos
+        || type.find("javascript") != std::string_view::npos;
+}
+
+std::string_view view(beast::string_view value)
+{
+    return {value.data(), value.size()};
+}
+
+// ALPN protocols in order of preference, length-prefixed
+constexpr std::string_view protocols = "\x02h2\x08http/1.1";
+
+enum class Range
+{
+    Whole,
+    Partial,
+    Unsatisfiable,
+};
+
+// Only a single byte range is served, several or malformed ones get the whole file
+Range parseRange(std::string_view value, uint64_t size, uint64_t& offset, uint64_t& length)
+{
+    if(value.substr(0, 6) != "bytes=" || value.find(',') != std::string_view::npos)
+        return Range::Whole;
+    value.remove_prefix(6);
+
+    auto dash = value.find('-');
+    if(dash == std::string_view::npos)
+        return Range::Whole;
+
+    auto number = [](std::string_view s, uint64_t& n) {
+        if(s.empty() || s.size() > 19)
+            return false;
+        n = 0;
+        for(char c: s) {
+            if(c < '0' || c > '9')
+                return false;
+            n = n * 10 + (c - '0');
+        }
+        return true;
+    };
+
+    uint64_t first = 0;
+    uint64_t last = 0;
+
+    if(dash == 0) {
+        // Suffix range: the last bytes of the file
+        if(!number(value.substr(1), last))
+            return Range::Whole;
+        if(last == 0 || size == 0)
+            return Range::Unsatisfiable;
+        length = std::min(last, size);
+        offset = size - length;
+        return Range::Partial;
+    }
+
+    if(!number(value.substr(0, dash), first))
+        return Range::Whole;
+
+    auto tail = value.substr(dash + 1);
+    if(tail.empty())
+        last = size ? size - 1 : 0;
+    else if(!number(tail, last) || last < first)
+        return Range::Whole;
+
+    if(first >= size)
+        return Range::Unsatisfiable;
+
+    offset = first;
+    length = std::min(last, size - 1) - first + 1;
+    return Range::Partial;
+}
+
+}
+
+void Server::Responder::send(Response response) const
+{
+    if(_state && !_state->done.exchange(true))
+        _state->complete(std::move(response));
+}
+
+
 Server::Server(asio::io_context& ioc)
-    : _ioc(ioc)
-    , _acceptor(ioc)
+    : Server(std::vector<asio::io_context*>{&ioc})
+{}
+
+Server::Server(std::vector<asio::io_context*> reactors)
+    : _reactors(std::move(reactors))
+    , _files(std::make_shared<FileCache>())
+    , _compressed(std::make_shared<CompressionCache>())
 {}
 
 void Server::setup(std::string_view host, uint16_t port)
@@ -16,12 +196,177 @@ void Server::setup(std::string_view host, uint16_t port)
     _endpoint = asio::ip::tcp::endpoint(address, port);
 }
 
+void Server::setOptions(Options const& options)
+{
+    _options = options;
+}
+
+void Server::setViewCallback(ViewCallbackType callback)
+{
+    _viewCallback = callback;
+}
+
+void Server::setRouter(std::shared_ptr<Router> router)
+{
+    router->compile();
+    _router = std::move(router);
+}
+
+void Server::setAsyncCallback(AsyncCallbackType callback, std::chrono::milliseconds deadline)
+{
+    _asyncCallback = callback;
+    _asyncDeadline = deadline;
+}
+
+void Server::setStreamCallback(StreamCallbackType callback)
+{
+    _streamCallback = callback;
+}
+
+void Server::setFileCache(std::shared_ptr<FileCache> cache)
+{
+    _files = std::move(cache);
+}
+
+void Server::setCompressionCache(std::shared_ptr<CompressionCache> cache)
+{
+    _compressed = std::move(cache);
+}
+
+void Server::setAccessLog(std::shared_ptr<AccessLog> log)
+{
+    _accessLog = std::move(log);
+}
+
+void Server::setMetrics(std::shared_ptr<ServerMetrics> metrics)
+{
+    _metrics = std::move(metrics);
+}
+
+void Server::setWorkerPool(std::shared_ptr<WorkerPool> workers, InlineType inlined)
+{
+    _workers = std::move(workers);
+    _inline = std::move(inlined);
+}
+
 void Server::setCallback(CallbackType callback)
 {
     _callback = callback;
 }
 
+bool Server::setCertificate(std::string_view cert, std::string_view key)
+{
+    auto processError = [](beast::error_code const& ec, std::string_view msg) -> bool {
+        LOG(error) << msg << ": " << ec.message();
+        return false;
+    };
+
+    auto context = std::make_shared<asio::ssl::context>(asio::ssl::context::tls_server);
+    context->set_options(
+        asio::ssl::context::default_workarounds
+        | asio::ssl::context::no_sslv2
+        | asio::ssl::context::no_sslv3
+        | asio::ssl::context::no_tlsv1
+        | asio::ssl::context::no_tlsv1_1
+        | asio::ssl::context::single_dh_use);
+
+    beast::error_code ec;
+    context->use_certificate_chain({cert.data(), cert.size()}, ec);
+    if(ec)
+        return processError(ec, "Certificate error");
+
+    context->use_private_key({key.data(), key.size()}, asio::ssl::context::pem, ec);
+    if(ec)
+        return processError(ec, "Private key error");
+
+    auto native = context->native_handle();
+    if(SSL_CTX_check_private_key(native) != 1) {
+        ec.assign(int(ERR_get_error()), asio::error::get_ssl_category());
+        return processError(ec, "Private key error");
+    }
+
+    std::lock_guard lock(_tlsMutex);
+
+    if(!_tls && RAND_bytes(_ticketKeys.data(), int(_ticketKeys.size())) != 1) {
+        ec.assign(int(ERR_get_error()), asio::error::get_ssl_category());
+        return processError(ec, "Ticket keys error");
+    }
+
+    SSL_CTX_set_tlsext_ticket_keys(native, _ticketKeys.data(), _ticketKeys.size());
+    SSL_CTX_set_alpn_select_cb(native, &Server::_selectProtocol, this);
+
+    _tls = std::move(context);
+    return true;
+}
+
+Server::SslContext Server::_tlsContext() const
+{
+    std::lock_guard lock(_tlsMutex);
+    return _tls;
+}
+
+void Server::_countHandshake(SSL* ssl, beast::error_code const& ec, metrics::Clock::time_point start) const
+{
+    if(!_metrics)
+        return;
+
+    if(ec) {
+        _metrics->handshakesFailed.add();
+        return;
+    }
+
+    _metrics->handshake.record(start);
+    if(SSL_session_reused(ssl))
+        _metrics->handshakesResumed.add();
+    else
+        _metrics->handshakesFull.add();
+}
+
+int Server::_selectProtocol(
+    SSL* ssl, unsigned char const** out, unsigned char* outSize,
+    unsigned char const* in, unsigned int inSize, void* user)
+{
+    boost::ignore_unused(ssl);
+
+    auto self = static_cast<Server const*>(user);
+
+    // HTTP/2 only when enabled, clients offering neither go on without ALPN
+    auto offered = self->_options.http2 ? protocols : protocols.substr(h2::alpn.size());
+
+    int rv = SSL_select_next_proto(
+        const_cast<unsigned char**>(out), outSize,
+        reinterpret_cast<unsigned char const*>(offered.data()), unsigned(offered.size()),
+        in, inSize);
+
+    return rv == OPENSSL_NPN_NEGOTIATED ? SSL_TLSEXT_ERR_OK : SSL_TLSEXT_ERR_NOACK;
+}
+
 bool Server::run()
+{
+    // With SO_REUSEPORT every io_context listens on its own socket
+    // and the kernel spreads new connections over them
+    std::size_t count = _options.reusePort ? _reactors.size() : 1;
+
+    for(std::size_t i = 0; i < count; ++i) {
+        _acceptors.push_back(std::make_unique<Acceptor>(asio::make_strand(*_reactors[i])));
+        if(!_listen(*_acceptors.back()))
+            return false;
+    }
+
+    // Started on the strand as well, the first accepts may already complete meanwhile
+    for(auto& acceptor: _acceptors) {
+        asio::dispatch(
+            acceptor->get_executor(),
+            [self = shared_from_this(), acceptor = acceptor.get()]() {
+                for(std::size_t i = 0; i < std::max<std::size_t>(self->_options.pendingAccepts, 1); ++i)
+                    self->_accept(*acceptor);
+            });
+    }
+
+    return true;
+}
+
+bool Server::_listen(Acceptor& acceptor)
 {
     beast::error_code ec;
 
@@ -30,140 +375,1136 @@ bool Server::run()
         return false;
     };
 
-    _acceptor.open(_endpoint.protocol(), ec);
+    acceptor.open(_endpoint.protocol(), ec);
     if(ec)
         return processError(ec, "Open error");
 
-    _acceptor.set_option(asio::socket_base::reuse_address(true), ec);
+    acceptor.set_option(asio::socket_base::reuse_address(true), ec);
     if(ec)
         return processError(ec, "Set option reuse error");
 
-    _acceptor.bind(_endpoint, ec);
+    if(_options.reusePort) {
+#ifdef SO_REUSEPORT
+        using reuse_port = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+        acceptor.set_option(reuse_port(true), ec);
+#else
+        ec = asio::error::operation_not_supported;
+#endif
+        if(ec)
+            return processError(ec, "Set option reuse port error");
+    }
+
+    acceptor.bind(_endpoint, ec);
     if(ec)
         return processError(ec, "Bind error");
 
-    _acceptor.listen(asio::socket_base::max_listen_connections, ec);
+    acceptor.listen(asio::socket_base::max_listen_connections, ec);
     if(ec)
         return processError(ec, "Listen error");
 
-    _accept();
-
     return true;
 }
 
-void Server::_accept()
+asio::io_context& Server::_nextReactor()
 {
-    _acceptor.async_accept(
-        asio::make_strand(_ioc),
+    return *_reactors[_next++ % _reactors.size()];
+}
+
+void Server::_accept(Acceptor& acceptor)
+{
+    // A connection stays on the io_context of its acceptor when each has one
+    asio::any_io_executor executor;
+    if(_options.reusePort)
+        executor = asio::make_strand(acceptor.get_executor().get_inner_executor());
+    else
+        executor = asio::make_strand(_nextReactor());
+
+    acceptor.async_accept(
+        executor,
         beast::bind_front_handler(
             &Server::_onAccept,
-            shared_from_this()));
+            shared_from_this(),
+            &acceptor));
 }
 
-void Server::_onAccept(beast::error_code ec, asio::ip::tcp::socket socket)
+void Server::_onAccept(Acceptor* acceptor, beast::error_code ec, asio::ip::tcp::socket socket)
 {
+    if(ec == asio::error::operation_aborted)
+        return;
+
     if(ec) {
         LOG(error) << "Accept error: " << ec.message();
+
+        // Out of descriptors or memory, accepting right away would spin
+        if(ec == asio::error::no_descriptors
+            || ec == asio::error::no_buffer_space
+            || ec == asio::error::no_memory
+            || ec == beast::error_code(ENFILE, beast::system_category())) {
+            auto timer = std::make_shared<asio::steady_timer>(acceptor->get_executor(), _acceptRetry);
+            timer->async_wait(
+                [self = shared_from_this(), acceptor, timer](beast::error_code ec) {
+                    if(!ec)
+                        self->_accept(*acceptor);
+                });
+            return;
+        }
+
+        return _accept(*acceptor);
+    }
+
+    if(_metrics)
+        _metrics->accepted.add();
+
+    std::allocate_shared<Session>(
+        FreeListAllocator<Session>(),
+        std::move(socket),
+        shared_from_this())->run();
+
+    _accept(*acceptor);
+}
+
+
+AllocatorStats Server::getAllocatorStats()
+{
+    return Arena::stats();
+}
+
+Response Server::_handle(RequestView::Message const& request) const
+{
+    if(!_metrics)
+        return _dispatch(request);
+
+    auto start = metrics::Clock::now();
+
+    Response rsp = _dispatch(request);
+
+    _metrics->handler.record(start);
+    return rsp;
+}
+
+Response Server::_dispatch(RequestView::Message const& request) const
+{
+    if(_isMetrics(request)) {
+        Response rsp;
+        rsp.fields["content-type"] = "text/plain; version=0.0.4";
+        rsp.body = _metrics->prometheus();
+        return rsp;
+    }
+
+    if(_router)
+        return _router->route(RequestView(request));
+
+    // The view callback reads straight from the parsed message, the other one gets a copy
+    if(_viewCallback)
+        return _viewCallback(RequestView(request));
+
+    if(_callback)
+        return _callback(_makeRequest(request));
+
+    return {};
+}
+
+bool Server::_isMetrics(RequestView::Message const& request) const
+{
+    return _metrics
+        && !_options.metricsTarget.empty()
+        && request.method() == http::verb::get
+        && request.target() == _options.metricsTarget;
+}
+
+bool Server::_isAsync(RequestView::Message const& request) const
+{
+    return _asyncCallback && !_router && !_isMetrics(request);
+}
+
+Request Server::_makeRequest(RequestView::Message const& request)
+{
+    Request req;
+    req.target = std::string(request.target());
+    url::parseQuery(req.target, req.params);
+    req.fields.reserve(std::distance(request.begin(), request.end()));
+    for(auto&& f: request) {
+        std::string key(f.name_string());
+        std::string value(f.value());
+        std::transform(key.begin(), key.end(), key.begin(), [](char c) { return std::tolower(c); });
+        req.fields.set(f.name(), std::move(key), std::move(value));
+    }
+    req.body = request.body();
+
+    return req;
+}
+
+void Server::_compress(RequestView::Message const& request, Message& response) const
+{
+    auto const& options = _options;
+    auto& body = response.body();
+
+    if(options.compressionLevel <= 0
+        || body.size() < options.compressionThreshold
+        || response.count(http::field::content_encoding)
+        || !compressible(view(response[http::field::content_type])))
+        return;
+
+    // Shared caches must keep the variants apart, whichever this client gets
+    auto vary = view(response[http::field::vary]);
+    if(vary.empty())
+        response.set(http::field::vary, "Accept-Encoding");
+    else if(vary.find("Accept-Encoding") == std::string_view::npos)
+        response.set(http::field::vary, std::string(vary) + ", Accept-Encoding");
+
+    auto encoding = negotiate(view(request[http::field::accept_encoding]));
+    if(encoding == Encoding::identity)
         return;
+
+    auto const& cache = _compressed;
+    std::string etag(view(response[http::field::etag]));
+    auto target = view(request.target());
+
+    CompressionCache::Body compressed;
+    if(!etag.empty())
+        compressed = cache->get(target, etag, encoding, options.compressionLevel, body.size());
+
+    if(!compressed) {
+        std::string out;
+        if(!compress(body, encoding, options.compressionLevel, out) || out.size() >= body.size())
+            return;
+
+        compressed = std::make_shared<std::string const>(std::move(out));
+        if(!etag.empty())
+            cache->store(target, etag, encoding, options.compressionLevel, body.size(), compressed);
     }
 
-    std::make_shared<Session>(std::move(socket), _callback)->run();
+    body.assign(*compressed);
+    auto token = toString(encoding);
+    response.set(http::field::content_encoding, beast::string_view(token.data(), token.size()));
 
-    _accept();
+    // The encoded representation is not byte-identical to the one the tag names
+    if(!etag.empty() && etag.compare(0, 2, "W/") != 0)
+        response.set(http::field::etag, "W/" + etag);
 }
 
+Server::FilePart Server::_prepareFile(RequestView::Message const& request, Message& response, std::string const& path) const
+{
+    auto file = _files->open(path);
+    if(!file) {
+        int error = errno;
+        LOG(warning) << "File " << path << ": " << std::strerror(error);
 
-Server::Session::Session(asio::ip::tcp::socket&& socket, CallbackType callback)
-    : _stream(std::move(socket))
-    , _callback(callback)
+        response.result(
+            error == ENOENT || error == ENOTDIR || error == EISDIR
+            ? http::status::not_found
+            : error == EACCES
+            ? http::status::forbidden
+            : http::status::internal_server_error);
+        response.body().clear();
+        response.prepare_payload();
+        return {};
+    }
+
+    uint64_t offset = 0;
+    uint64_t length = file->size;
+
+    if(response.result() == http::status::ok) {
+        response.set(http::field::etag, file->etag);
+        response.set(http::field::last_modified, file->lastModified);
+        response.set(http::field::accept_ranges, "bytes");
+
+        bool safe = request.method() == http::verb::get || request.method() == http::verb::head;
+
+        // If-None-Match takes precedence, If-Modified-Since only counts without it
+        bool modified = true;
+        if(auto it = request.find(http::field::if_none_match); it != request.end()) {
+            modified = !matchesEtag({it->value().data(), it->value().size()}, file->etag);
+        }
+        else if(auto it = request.find(http::field::if_modified_since); it != request.end()) {
+            auto since = parseDate({it->value().data(), it->value().size()});
+            modified = !since || file->modified > *since;
+        }
+
+        if(safe && !modified) {
+            response.result(http::status::not_modified);
+            return {};
+        }
+
+        // A stale If-Range validator asks for the whole file
+        auto range = request.find(http::field::range);
+        auto ifRange = request.find(http::field::if_range);
+        if(request.method() == http::verb::get
+            && range != request.end()
+            && (ifRange == request.end() || ifRange->value() == file->etag)) {
+            switch(parseRange({range->value().data(), range->value().size()}, file->size, offset, length)) {
+            case Range::Whole:
+                break;
+
+            case Range::Partial:
+                response.result(http::status::partial_content);
+                response.set(
+                    http::field::content_range,
+                    "bytes " + std::to_string(offset) + "-" + std::to_string(offset + length - 1)
+                    + "/" + std::to_string(file->size));
+                break;
+
+            case Range::Unsatisfiable:
+                response.result(http::status::range_not_satisfiable);
+                response.set(http::field::content_range, "bytes */" + std::to_string(file->size));
+                response.content_length(0);
+                return {};
+            }
+        }
+    }
+
+    response.content_length(length);
+
+    if(request.method() == http::verb::head || length == 0)
+        return {};
+
+    return {std::move(file), offset, length};
+}
+
+Server::Session::Slot::Slot(ArenaAllocator<char> const& allocator)
+    : message(std::piecewise_construct, std::make_tuple(), std::make_tuple(allocator))
 {}
 
+Server::Session::Session(asio::ip::tcp::socket&& socket, std::shared_ptr<Server const> server)
+    : _stream(std::move(socket))
+    , _timer(_stream.get_executor())
+    , _buffer(takeBuffer())
+    , _server(std::move(server))
+{
+    if(auto size = _server->_options.arenaSize)
+        _arena = std::allocate_shared<Arena>(FreeListAllocator<Arena>(), size);
+
+    _buffer.reserve(_server->_options.limits.bufferCapacity);
+
+    if(_server->_accessLog) {
+        beast::error_code ec;
+        _remote = _stream.socket().remote_endpoint(ec).address();
+    }
+
+    if((_context = _server->_tlsContext()))
+        _ssl = std::make_unique<SslStream>(std::move(_stream), *_context);
+
+    if(_server->_metrics)
+        _server->_metrics->sessions.add();
+}
+
+Server::Session::~Session()
+{
+    if(_server->_metrics)
+        _server->_metrics->sessions.sub();
+
+    giveBuffer(std::move(_buffer), _server->_options.limits.bufferCapacity);
+}
+
 void Server::Session::run()
 {
+    // The handshake runs on the session strand, the acceptor goes on meanwhile
+    auto start = _ssl
+        ? &Session::_handshake
+        : _server->_options.http2 ? &Session::_detect : &Session::_read;
+
     asio::dispatch(
-        _stream.get_executor(),
+        _lowest().get_executor(),
         beast::bind_front_handler(
-            &Session::_onRun,
+            start,
             shared_from_this()));
 }
 
-void Server::Session::_onRun()
+void Server::Session::_handshake()
 {
-    _stream.expires_after(std::chrono::seconds(10));
+    _lowest().expires_after(_server->_options.readTimeout);
+    if(_server->_metrics)
+        _handshakeStart = metrics::Clock::now();
 
-    http::async_read(
-        _stream, _buffer, _request,
+    _ssl->async_handshake(
+        asio::ssl::stream_base::server,
         beast::bind_front_handler(
-            &Session::_onRead,
+            &Session::_onHandshake,
             shared_from_this()));
 }
 
-void Server::Session::_onRead(beast::error_code ec, std::size_t bytes_transferred)
+void Server::Session::_onHandshake(beast::error_code ec)
 {
-    boost::ignore_unused(bytes_transferred);
+    _server->_countHandshake(_ssl->native_handle(), ec, _handshakeStart);
 
-    if(ec)
-        return _processError(ec, "Read");
+    if(ec) {
+        if(ec != asio::error::eof && ec != beast::error::timeout)
+            _processError(ec, "Handshake");
+        return;
+    }
+
+    // With TLS the protocol is agreed on through ALPN, there is no preface to look for
+    unsigned char const* protocol = nullptr;
+    unsigned int size = 0;
+    SSL_get0_alpn_selected(_ssl->native_handle(), &protocol, &size);
+
+    if(std::string_view(reinterpret_cast<char const*>(protocol), size) == h2::alpn.substr(1)) {
+        std::make_shared<Http2Session>(std::move(_ssl), _server)->run({});
+        return;
+    }
+
+    _read();
+}
 
-    _processRequest();
+void Server::Session::_detect()
+{
+    // Clients with prior knowledge of HTTP/2 open with its preface instead of a request line
+    auto const preface = h2::preface;
+    std::string_view received(static_cast<char const*>(_buffer.data().data()), _buffer.size());
 
-    http::async_write(
-        _stream, _response,
+    if(received.size() >= preface.size() || preface.compare(0, received.size(), received) != 0) {
+        if(received.substr(0, preface.size()) != preface)
+            return _read();
+
+        std::make_shared<Http2Session>(std::move(_stream), _server)->run(received);
+        return;
+    }
+
+    _lowest().expires_after(_server->_options.readTimeout);
+
+    _lowest().async_read_some(
+        _buffer.prepare(_server->_options.limits.readSize),
         beast::bind_front_handler(
-            &Session::_onWrite,
+            &Session::_onDetect,
             shared_from_this()));
 }
 
-void Server::Session::_onWrite(beast::error_code ec, std::size_t bytes_transferred)
+void Server::Session::_onDetect(beast::error_code ec, std::size_t bytes_transferred)
+{
+    if(ec) {
+        if(ec != asio::error::eof && ec != beast::error::timeout)
+            _processError(ec, "Read");
+        return _close();
+    }
+
+    _buffer.commit(bytes_transferred);
+
+    _detect();
+}
+
+void Server::Session::_read()
+{
+    _reading = true;
+
+    if(_requests == 0 || _buffer.size())
+        return _readRequest();
+
+    // A kept-alive connection waits for the first bytes of the next request
+    // under the idle timeout, the request itself is read under the read timeout
+    _lowest().expires_after(_server->_options.idleTimeout);
+
+    _withStream([this](auto& stream) {
+        stream.async_read_some(
+            _buffer.prepare(_server->_options.limits.readSize),
+            beast::bind_front_handler(
+                &Session::_onIdle,
+                shared_from_this()));
+    });
+}
+
+void Server::Session::_onIdle(beast::error_code ec, std::size_t bytes_transferred)
+{
+    if(ec) {
+        _reading = false;
+        _closing = true;
+
+        if(ec != asio::error::eof && ec != beast::error::timeout)
+            _processError(ec, "Read");
+
+        if(_queue.empty())
+            _close();
+        return;
+    }
+
+    _buffer.commit(bytes_transferred);
+
+    _readRequest();
+}
+
+void Server::Session::_readRequest()
+{
+    _parser.emplace(
+        std::piecewise_construct,
+        std::make_tuple(),
+        std::make_tuple(ArenaAllocator<char>(_arena)));
+
+    auto const& limits = _server->_options.limits;
+    _parser->header_limit(limits.headerSize);
+    _parser->body_limit(limits.bodySize);
+
+    // The limit is lifted for bodies that may be streamed and checked once the header is known,
+    // boost::none would reject any content length as it compares below every value
+    if(_server->_streamCallback)
+        _parser->body_limit(std::numeric_limits<std::uint64_t>::max());
+
+    _lowest().expires_after(_server->_options.readTimeout);
+
+    _withStream([this](auto& stream) {
+        http::async_read_header(
+            stream, _buffer, *_parser,
+            beast::bind_front_handler(
+                &Session::_onHeader,
+                shared_from_this()));
+    });
+}
+
+void Server::Session::_onHeader(beast::error_code ec, std::size_t bytes_transferred)
+{
+    // What the body read adds is counted on its own completion
+    if(_server->_metrics)
+        _server->_metrics->bytesReceived.add(bytes_transferred);
+
+    if(ec || _parser->is_done())
+        return _onRead(ec, 0);
+
+    if(auto const& callback = _server->_streamCallback) {
+        _body = callback(RequestView(_parser->get()));
+
+        if(_body.sink) {
+            _bodyParser.emplace(std::move(*_parser));
+            _parser.reset();
+            _readChunk.resize(_server->_options.chunkSize);
+            return _readBody();
+        }
+
+        auto limit = _server->_options.limits.bodySize;
+        _parser->body_limit(limit);
+
+        auto length = _parser->content_length();
+        if(length && *length > limit)
+            return _onRead(http::error::body_limit, 0);
+    }
+
+    _withStream([this](auto& stream) {
+        http::async_read(
+            stream, _buffer, *_parser,
+            beast::bind_front_handler(
+                &Session::_onRead,
+                shared_from_this()));
+    });
+}
+
+void Server::Session::_onRead(beast::error_code ec, std::size_t bytes_transferred)
+{
+    if(_server->_metrics)
+        _server->_metrics->bytesReceived.add(bytes_transferred);
+
+    _reading = false;
+
+    if(ec) {
+        _closing = true;
+
+        // Oversized requests are answered before the connection closes
+        if(ec == http::error::body_limit)
+            return _reject(http::status::payload_too_large);
+        if(ec == http::error::header_limit)
+            return _reject(http::status::request_header_fields_too_large);
+
+        if(ec != http::error::end_of_stream)
+            _processError(ec, "Read");
+
+        if(_queue.empty())
+            _close();
+        return;
+    }
+
+    _processRequest(_push(_parser->release()));
+
+    _readNext();
+}
+
+void Server::Session::_readBody()
+{
+    auto& body = _bodyParser->get().body();
+    body.data = _readChunk.data();
+    body.size = _readChunk.size();
+
+    _lowest().expires_after(_server->_options.readTimeout);
+
+    _withStream([this](auto& stream) {
+        http::async_read(
+            stream, _buffer, *_bodyParser,
+            beast::bind_front_handler(
+                &Session::_onBody,
+                shared_from_this()));
+    });
+}
+
+void Server::Session::_onBody(beast::error_code ec, std::size_t bytes_transferred)
+{
+    // The chunk buffer is full
+    if(ec == http::error::need_buffer)
+        ec = {};
+
+    if(_server->_metrics)
+        _server->_metrics->bytesReceived.add(bytes_transferred);
+
+    if(ec) {
+        _bodyParser.reset();
+        _body = {};
+        return _onRead(ec, 0);
+    }
+
+    std::size_t size = _readChunk.size() - _bodyParser->get().body().size;
+    bool accepted = !size || _body.sink({_readChunk.data(), size});
+
+    if(accepted && !_bodyParser->is_done())
+        return _readBody();
+
+    _reading = false;
+
+    // The streamed request keeps only its header, the body went to the sink
+    auto slot = _push(RequestView::Message(std::move(_bodyParser->release().base())));
+    _bodyParser.reset();
+
+    // The rest of a rejected body is left unread, the connection cannot be reused
+    if(!accepted) {
+        slot->message.keep_alive(false);
+        _closing = true;
+        _linger = true;
+    }
+
+    auto complete = std::move(_body.complete);
+    _body = {};
+
+    LOG_MESSAGE << slot->request.base();
+
+    _complete(*slot, complete ? complete() : Response());
+
+    _readNext();
+}
+
+void Server::Session::_reject(http::status status)
+{
+    LOG(warning) << "Read: request rejected with " << unsigned(status);
+
+    // The header is complete when only the body was too large
+    RequestView::Message request;
+    if(_parser && _parser->is_header_done())
+        request = _parser->release();
+    else
+        request.version(11);
+    _parser.reset();
+
+    auto slot = _push(std::move(request));
+    slot->message.keep_alive(false);
+    _linger = true;
+
+    Response rsp;
+    rsp.result = status;
+    _complete(*slot, std::move(rsp));
+}
+
+void Server::Session::_readNext()
+{
+    // Keep reading pipelined requests until the queue is full
+    if(!_closing && _queue.size() < _server->_options.pipelineLimit)
+        _read();
+}
+
+std::shared_ptr<Server::Session::Slot> Server::Session::_push(RequestView::Message&& request)
+{
+    ++_requests;
+    if(_server->_metrics)
+        _server->_metrics->requests.add();
+
+    auto const& options = _server->_options;
+
+    // Responses are written in the order the requests arrived,
+    // whenever their handlers complete
+    ArenaAllocator<char> allocator(_arena);
+    auto slot = std::allocate_shared<Slot>(ArenaAllocator<Slot>(allocator), allocator);
+    slot->request = std::move(request);
+    slot->message.version(slot->request.version());
+
+    if(auto const& log = _server->_accessLog; log && log->sample()) {
+        auto& record = slot->log.emplace();
+        record.time = AccessLog::now();
+        record.method = uint16_t(slot->request.method());
+        record.version = uint8_t(slot->request.version());
+        record.setTarget(view(slot->request.target()));
+        record.setAddress(_remote);
+    }
+    slot->message.keep_alive(
+        slot->request.keep_alive()
+        && (options.maxRequests == 0 || _requests < options.maxRequests));
+
+    if(!slot->message.keep_alive())
+        _closing = true;
+
+    _queue.push_back(slot);
+
+    return slot;
+}
+
+void Server::Session::_flush()
+{
+    if(_writing || _queue.empty() || !_queue.front()->ready)
+        return;
+
+    _writing = true;
+    if(_server->_metrics)
+        _writeStart = metrics::Clock::now();
+    _written = 0;
+
+    if(_queue.front()->source || _queue.front()->headerOnly)
+        return _writeStream();
+
+    if(_queue.front()->file)
+        return _writeFile();
+
+    _lowest().expires_after(_server->_options.writeTimeout);
+
+    _withStream([this](auto& stream) {
+        http::async_write(
+            stream, _queue.front()->message,
+            beast::bind_front_handler(
+                &Session::_onWrite,
+                shared_from_this()));
+    });
+}
+
+void Server::Session::_writeStream()
 {
-    boost::ignore_unused(bytes_transferred);
+    // The header goes first, then the body as the source hands it out
+    _writeChunk.resize(_server->_options.chunkSize);
+
+    _streamed.emplace(_queue.front()->message.base());
+    _streamed->body().data = nullptr;
+    _streamed->body().more = true;
+    _serializer.emplace(*_streamed);
+
+    _lowest().expires_after(_server->_options.writeTimeout);
+
+    _withStream([this](auto& stream) {
+        http::async_write_header(
+            stream, *_serializer,
+            beast::bind_front_handler(
+                &Session::_onWriteChunk,
+                shared_from_this()));
+    });
+}
+
+void Server::Session::_onWriteChunk(beast::error_code ec, std::size_t bytes_transferred)
+{
+    // The serializer asks for the next piece
+    if(ec == http::error::need_buffer)
+        ec = {};
+
+    _sent(bytes_transferred);
+
+    if(ec || _serializer->is_done() || _queue.front()->headerOnly) {
+        _serializer.reset();
+        _streamed.reset();
+        return _onWrite(ec, 0);
+    }
+
+    auto size = _queue.front()->source(_writeChunk.data(), _writeChunk.size());
+
+    // As with sendfile, a short file ends the connection instead of the body
+    if(_queue.front()->truncated) {
+        _serializer.reset();
+        _streamed.reset();
+        return _onWrite(asio::error::eof, 0);
+    }
+
+    auto& body = _streamed->body();
+    body.data = size ? _writeChunk.data() : nullptr;
+    body.size = size;
+    body.more = size > 0;
+
+    _lowest().expires_after(_server->_options.writeTimeout);
+
+    _withStream([this](auto& stream) {
+        http::async_write(
+            stream, *_serializer,
+            beast::bind_front_handler(
+                &Session::_onWriteChunk,
+                shared_from_this()));
+    });
+}
+
+void Server::Session::_writeFile()
+{
+    // The header goes through beast, the body from the file straight to the socket
+    _streamed.emplace(_queue.front()->message.base());
+    _streamed->body().data = nullptr;
+    _streamed->body().more = true;
+    _serializer.emplace(*_streamed);
+
+    _lowest().expires_after(_server->_options.writeTimeout);
+
+    _withStream([this](auto& stream) {
+        http::async_write_header(
+            stream, *_serializer,
+            beast::bind_front_handler(
+                &Session::_onFileHeader,
+                shared_from_this()));
+    });
+}
+
+void Server::Session::_onFileHeader(beast::error_code ec, std::size_t bytes_transferred)
+{
+    _serializer.reset();
+    _streamed.reset();
+
+    _sent(bytes_transferred);
 
     if(ec)
-        return _processError(ec, "Write");
+        return _onWrite(ec, 0);
+
+    beast::error_code nec;
+    _lowest().socket().non_blocking(true, nec);
+
+    _sendFile();
+}
+
+void Server::Session::_sendFile()
+{
+    auto& slot = *_queue.front();
+    int socket = _lowest().socket().native_handle();
+
+    uint64_t sent = 0;
+    while(slot.remaining) {
+        // Other sessions of this thread get their turn between bursts
+        if(sent >= _sendfileBurst) {
+            asio::post(
+                _lowest().get_executor(),
+                beast::bind_front_handler(
+                    &Session::_sendFile,
+                    shared_from_this()));
+            return;
+        }
+
+        std::size_t size = std::min<uint64_t>(slot.remaining, _sendfileBurst);
+
+#ifdef __linux__
+        off_t offset = slot.offset;
+        ssize_t n = ::sendfile(socket, slot.file->fd, &offset, size);
+#else
+        // Without sendfile the piece takes one copy through the chunk buffer
+        _writeChunk.resize(std::min(size, _server->_options.chunkSize));
+        ssize_t n = ::pread(slot.file->fd, _writeChunk.data(), _writeChunk.size(), slot.offset);
+        if(n > 0)
+            n = ::send(socket, _writeChunk.data(), n, 0);
+#endif
+
+        if(n > 0) {
+            slot.offset += n;
+            slot.remaining -= n;
+            sent += n;
+            _sent(std::size_t(n));
+            continue;
+        }
+
+        if(n < 0 && errno == EINTR)
+            continue;
+
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // The socket buffer is full, the timer bounds the wait as the stream timeout would
+            _timer.expires_after(_server->_options.writeTimeout);
+            _timer.async_wait(
+                [self = shared_from_this()](beast::error_code ec) {
+                    if(!ec)
+                        self->_lowest().socket().cancel();
+                });
+
+            _lowest().socket().async_wait(
+                asio::ip::tcp::socket::wait_write,
+                beast::bind_front_handler(
+                    &Session::_onWritable,
+                    shared_from_this()));
+            return;
+        }
+
+        // The file shrank below its announced length
+        beast::error_code ec = n == 0
+            ? asio::error::eof
+            : beast::error_code(errno, beast::system_category());
+        return _onWrite(ec, 0);
+    }
+
+    slot.file.reset();
+
+    _onWrite({}, 0);
+}
+
+void Server::Session::_onWritable(beast::error_code ec)
+{
+    bool expired = _timer.expiry() <= asio::steady_timer::clock_type::now();
+    _timer.cancel();
+
+    if(ec == asio::error::operation_aborted && expired)
+        ec = beast::error::timeout;
+
+    if(ec)
+        return _onWrite(ec, 0);
+
+    _sendFile();
+}
+
+void Server::Session::_onWrite(beast::error_code ec, std::size_t bytes_transferred)
+{
+    _sent(bytes_transferred);
+
+    _writing = false;
+
+    if(ec) {
+        _processError(ec, "Write");
+        return _lowest().close();
+    }
+
+    if(_server->_metrics)
+        _server->_metrics->write.record(_writeStart);
+
+    if(auto& record = _queue.front()->log) {
+        record->status = uint16_t(_queue.front()->message.result_int());
+        record->bytes = _written;
+        record->duration = uint32_t(AccessLog::now() - record->time);
+        _server->_accessLog->push(*record);
+    }
+
+    bool close = _queue.front()->message.need_eof();
+    _queue.pop_front();
 
-    _stream.socket().shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+    if(close || (_closing && _queue.empty() && !_reading))
+        return _close();
+
+    _flush();
+
+    // Reading was paused while the queue was full
+    if(!_reading && !_closing && _queue.size() < _server->_options.pipelineLimit)
+        _read();
+}
+
+void Server::Session::_sent(std::size_t bytes)
+{
+    if(_server->_metrics)
+        _server->_metrics->bytesSent.add(bytes);
+    _written += bytes;
+}
+
+void Server::Session::_close()
+{
+    // The close_notify exchange also takes what the peer still sends, it cannot run
+    // next to a pending read and then the connection ends as a plaintext one would
+    if(_ssl && !_reading) {
+        _lowest().expires_after(_server->_options.writeTimeout);
+        _ssl->async_shutdown(
+            [self = shared_from_this()](beast::error_code) {
+                beast::error_code ec;
+                self->_lowest().socket().shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+            });
+        return;
+    }
+
+    beast::error_code ec;
+    _lowest().socket().shutdown(asio::ip::tcp::socket::shutdown_send, ec);
+
+    // Closing with unread bytes resets the connection, which may destroy the answer in flight
+    if(_linger && !ec && !_reading) {
+        _lowest().expires_after(_server->_options.readTimeout);
+        _drain();
+    }
+}
+
+void Server::Session::_drain()
+{
+    // Discards whatever the peer still sends until it closes or the timeout passes
+    _lowest().async_read_some(
+        _buffer.prepare(_server->_options.limits.readSize),
+        [self = shared_from_this()](beast::error_code ec, std::size_t) {
+            self->_buffer.clear();
+            if(!ec)
+                self->_drain();
+        });
+}
+
+template<typename Function>
+void Server::Session::_withStream(Function&& function)
+{
+    if(_ssl)
+        function(*_ssl);
+    else
+        function(_stream);
+}
+
+beast::tcp_stream& Server::Session::_lowest()
+{
+    return _ssl ? beast::get_lowest_layer(*_ssl) : _stream;
 }
 
-void Server::Session::_processRequest()
+void Server::Session::_processRequest(std::shared_ptr<Slot> slot)
 {
-    LOG(debug)
-        << _request.base()
-        << (_request.payload_size() < _payloadLimit
-            ? _request.body()
+    LOG_MESSAGE
+        << slot->request.base()
+        << (slot->request.payload_size() < _payloadLimit
+            ? slot->request.body()
             : "");
 
-    Request req;
-    req.target = std::string(_request.target());
-    for(auto&& f: _request) {
-        std::string key(f.name_string());
-        std::string value(f.value());
-        std::transform(key.begin(), key.end(), key.begin(), [](char c) { return std::tolower(c); });
-        req.fields[key] = value;
+    if(_server->_isAsync(slot->request)) {
+        // Copied before the slot is moved, arguments are evaluated in no particular order
+        Request req = _makeRequest(slot->request);
+        return _processAsync(std::move(req), std::move(slot));
     }
-    req.body = _request.body();
 
-    Response rsp;
-    if(_callback)
-        rsp = _callback(req);
+    auto const& workers = _server->_workers;
+    auto const& inlined = _server->_inline;
+
+    if(workers && !(inlined && inlined(RequestView(slot->request)))) {
+        // The handler runs on a worker thread, its response comes back through the session strand
+        if(_server->_metrics)
+            slot->queued = metrics::Clock::now();
+        bool posted = workers->post(
+            [self = shared_from_this(), slot]() {
+                if(self->_server->_metrics)
+                    self->_server->_metrics->queue.record(slot->queued);
 
-    _response.version(_version);
-    _response.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+                // A throwing handler still answers, else the pipeline behind it would wait forever
+                Response rsp;
+                try {
+                    rsp = self->_server->_handle(slot->request);
+                }
+                catch(std::exception const& e) {
+                    LOG(error) << "Handler: " << e.what();
+                    rsp = Response();
+                    rsp.result = http::status::internal_server_error;
+                }
 
-    _response.result(rsp.result);
+                asio::post(
+                    self->_lowest().get_executor(),
+                    [self, slot, rsp = std::move(rsp)]() mutable {
+                        self->_complete(*slot, std::move(rsp));
+                    });
+            });
+
+        if(!posted) {
+            // Shed load instead of queueing without bound
+            Response rsp;
+            rsp.result = http::status::service_unavailable;
+            rsp.fields["retry-after"] = "1";
+            _complete(*slot, std::move(rsp));
+        }
+        return;
+    }
+
+    _complete(*slot, _server->_handle(slot->request));
+}
+
+void Server::Session::_processAsync(Request&& req, std::shared_ptr<Slot> slot)
+{
+    // The slot stays parked until the responder sends or the deadline passes,
+    // whichever comes first completes it
+    auto timer = std::make_shared<asio::steady_timer>(_lowest().get_executor());
+
+    // The handler time runs until the responder sends
+    auto start = _server->_metrics ? metrics::Clock::now() : metrics::Clock::time_point();
+
+    auto state = std::make_shared<Responder::State>();
+    state->request = std::move(req);
+    state->complete = [self = shared_from_this(), slot, timer, start](Response&& rsp) {
+        if(self->_server->_metrics)
+            self->_server->_metrics->handler.record(start);
+
+        asio::post(
+            self->_lowest().get_executor(),
+            [self, slot, timer, rsp = std::move(rsp)]() mutable {
+                timer->cancel();
+                self->_complete(*slot, std::move(rsp));
+            });
+    };
+
+    timer->expires_after(_server->_asyncDeadline);
+    timer->async_wait(
+        [self = shared_from_this(), slot, state](beast::error_code ec) {
+            if(ec || state->done.exchange(true))
+                return;
+
+            Response rsp;
+            rsp.result = http::status::gateway_timeout;
+            self->_complete(*slot, std::move(rsp));
+        });
+
+    Responder responder;
+    responder._state = state;
+
+    _server->_asyncCallback(state->request, std::move(responder));
+}
+
+void Server::Session::_complete(Slot& slot, Response&& rsp)
+{
+    auto& response = slot.message;
+    bool head = slot.request.method() == http::verb::head;
+    response.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+
+    response.result(rsp.result);
 
     for(auto& [key, value]: rsp.fields)
-        _response.set(key, value);
+        response.set(key, value);
+
+    if(!rsp.file.empty()) {
+        auto part = _server->_prepareFile(slot.request, response, rsp.file);
+
+        // sendfile would bypass the encryption, the file goes through the chunk buffer instead
+        if(_ssl && part.file) {
+            slot.source = [part = std::move(part), &slot](char* data, std::size_t size) mutable -> std::size_t {
+                ssize_t n;
+                do {
+                    n = ::pread(part.file->fd, data, std::min<uint64_t>(size, part.remaining), part.offset);
+                } while(n < 0 && errno == EINTR);
+
+                // The response cannot reach its announced length, the write fails on it
+                if(n <= 0) {
+                    slot.truncated = true;
+                    return 0;
+                }
 
-    if(!rsp.body.empty()) {
-        _response.body() = rsp.body;
-        _response.prepare_payload();
+                part.offset += n;
+                part.remaining -= n;
+                return std::size_t(n);
+            };
+        }
+        else {
+            slot.file = std::move(part.file);
+            slot.offset = part.offset;
+            slot.remaining = part.remaining;
+        }
     }
+    else if(rsp.source) {
+        // HEAD is answered with the header alone, the source is dropped unread
+        if(head)
+            slot.headerOnly = true;
+        else
+            slot.source = std::move(rsp.source);
 
-    LOG(debug)
-        << _response.base()
-        << (_response.payload_size() < _payloadLimit
-            ? _response.body()
+        // HTTP/1.0 has no chunked encoding, the end of the body is the end of the connection
+        if(response.version() < 11)
+            response.keep_alive(false);
+        else
+            response.chunked(true);
+    }
+    else {
+        response.body() = std::move(rsp.body);
+        _server->_compress(slot.request, response);
+        response.prepare_payload();
+    }
+
+    // HEAD is answered with the length the body would have, not the body
+    if(head)
+        response.body().clear();
+
+    // The request is not needed anymore while the response waits for its turn
+    slot.request = {};
+
+    LOG_MESSAGE
+        << response.base()
+        << (response.payload_size() < _payloadLimit
+            ? response.body()
             : "");
+
+    slot.ready = true;
+
+    _flush();
 }
 
 void Server::Session::_processError(beast::error_code const& ec, std::string_view msg)
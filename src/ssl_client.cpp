@@ -1,16 +1,21 @@
+#include <limits>
 #include <sstream>
-#include <thread>
 
 #include <loguru.hpp>
 
 #include "http/ssl_client.hpp"
+#include "http/url.hpp"
+
+#include "debug.hpp"
 
 namespace http
 {
 
 SslClient::SslClient(asio::io_context& ioc, asio::ssl::context& ctx)
-    : _resolver(ioc)
-    , _stream(ioc, ctx)
+    : _strand(asio::make_strand(ioc))
+    , _ctx(ctx)
+    , _resolver(_strand)
+    , _errorTimer(_strand)
 {}
 
 void SslClient::setup(std::string_view host, uint16_t port)
@@ -19,79 +24,201 @@ void SslClient::setup(std::string_view host, uint16_t port)
     _port = port;
 }
 
+void SslClient::setResolveCache(std::shared_ptr<ResolveCache> cache)
+{
+    _cache = std::move(cache);
+}
+
+void SslClient::setMetrics(std::shared_ptr<ClientMetrics> metrics)
+{
+    _metrics = std::move(metrics);
+}
+
+void SslClient::setSessionCache(std::shared_ptr<TlsSessionCache> cache)
+{
+    _sessions = std::move(cache);
+}
+
 void SslClient::setTimeout(std::chrono::seconds timeout)
 {
     _timeout = timeout;
 }
 
-bool SslClient::get(Request const& request, std::string& response)
+void SslClient::setChunkSize(std::size_t size)
+{
+    _chunkSize = size;
+}
+
+void SslClient::setLimits(Limits const& limits)
 {
-    std::scoped_lock lock(_mutex);
-    _createRequest(request, http::verb::get);
-    _run();
+    _limits = limits;
+}
 
-    _condition.wait(_mutex);
+void SslClient::setDecompression(bool enabled)
+{
+    _decompression = enabled;
+}
 
-    if(_ec)
-        return false;
+bool SslClient::isConnected() const
+{
+    return _connected;
+}
 
-    response = _response.body();
-    return true;
+bool SslClient::get(Request const& request, std::string& response)
+{
+    return _call(_createOperation(request, http::verb::get), response);
 }
 
 bool SslClient::post(Request const& request, std::string& response)
 {
-    std::scoped_lock lock(_mutex);
-    _createRequest(request, http::verb::post);
-    _run();
+    return _call(_createOperation(request, http::verb::post), response);
+}
 
-    _condition.wait(_mutex);
+bool SslClient::get(Request const& request, SinkType sink)
+{
+    std::string response;
+    return _call(_createOperation(request, http::verb::get, std::move(sink)), response);
+}
+
+bool SslClient::post(Request const& request, SinkType sink)
+{
+    std::string response;
+    return _call(_createOperation(request, http::verb::post, std::move(sink)), response);
+}
+
+bool SslClient::_call(Operation operation, std::string& response)
+{
+    std::promise<std::pair<beast::error_code, std::string>> promise;
+    auto future = promise.get_future();
+
+    operation.handler = [&promise](beast::error_code ec, std::string body) {
+        promise.set_value({ec, std::move(body)});
+    };
+    _enqueue(std::move(operation));
 
-    if(_ec)
+    auto [ec, body] = future.get();
+    if(ec)
         return false;
 
-    response = _response.body();
+    response = std::move(body);
     return true;
 }
 
-void SslClient::_createRequest(Request const& request, http::verb method)
+void SslClient::_enqueue(Operation operation)
 {
-    std::string target = request.target;
-    if(request.params.size()) {
-        target += "?";
-        for(auto& [key, value]: request.params)
-            target += key + "=" + value + "&";
-        target.pop_back();
-    }
+    // Requests of one client are sent one after another over its connection
+    asio::post(
+        _strand,
+        [self = shared_from_this(), operation = std::move(operation)]() mutable {
+            self->_queue.push_back(std::move(operation));
+            if(self->_queue.size() == 1)
+                self->_run();
+        });
+}
 
-    _request.version(_version);
-    _request.method(method);
-    _request.target(target);
-    _request.set(http::field::host, _host);
-    _request.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+void SslClient::_complete(beast::error_code const& ec)
+{
+    auto handler = std::move(_queue.front().handler);
+    _queue.pop_front();
+
+    std::string body;
+    if(!ec && _parser)
+        body = std::move(_parser->get().body());
+
+    _parser.reset();
+    _serializer.reset();
+    _upload.reset();
+    _download.reset();
+
+    handler(ec, std::move(body));
+
+    if(!_queue.empty())
+        _run();
+}
+
+SslClient::RequestType SslClient::_createRequest(Request const& request, http::verb method) const
+{
+    std::string target = url::makeTarget(request.target, request.params);
+
+    RequestType req;
+    req.version(_version);
+    req.method(method);
+    req.target(target);
+    req.set(http::field::host, _host);
+    req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
 
     for(auto& [key, value]: request.fields)
-        _request.set(key, value);
+        req.set(key, value);
 
-    if(!request.body.empty()) {
-        _request.body() = request.body;
-        _request.prepare_payload();
+    if(request.source) {
+        if(!req.has_content_length())
+            req.chunked(true);
+    }
+    else if(!request.body.empty()) {
+        req.body() = request.body;
+        req.prepare_payload();
     }
 
-    LOG(debug)
-        << _request.base()
-        << (_request.payload_size() < _payloadLimit
-            ? _request.body()
+    LOG_MESSAGE
+        << req.base()
+        << (req.payload_size() < _payloadLimit
+            ? req.body()
             : "");
+
+    return req;
+}
+
+SslClient::Operation SslClient::_createOperation(Request const& request, http::verb method, SinkType sink) const
+{
+    Operation operation{_createRequest(request, method), request.source, std::move(sink), nullptr};
+
+    if(_decompression && !operation.sink && !operation.request.count(http::field::accept_encoding))
+        operation.request.set(http::field::accept_encoding, "gzip, deflate");
+
+    return operation;
 }
 
 void SslClient::_run()
 {
-    if(!SSL_set_tlsext_host_name(_stream.native_handle(), _host.data())) {
+    _request = std::move(_queue.front().request);
+    _retried = false;
+    _streamed = false;
+
+    if(_metrics)
+        _metrics->requests.add();
+
+    // Reuse the kept-alive connection unless the server has closed it
+    if(_connected && _isAlive()) {
+        _reused = true;
+        return _write();
+    }
+
+    _close();
+    _resolve();
+}
+
+void SslClient::_resolve()
+{
+    _reused = false;
+
+    _stream = std::make_shared<Stream>(_strand, _ctx);
+
+    if(!SSL_set_tlsext_host_name(_stream->native_handle(), _host.data())) {
         beast::error_code ec((int)ERR_get_error(), asio::error::get_ssl_category());
-        _processError(ec, "Ssl set:");
+        return _processError(ec, "Ssl set");
+    }
+
+    if(_cache) {
+        beast::error_code ec;
+        if(_cache->lookup(_host, _port, _endpoints, ec)) {
+            if(ec)
+                return _processError(ec, "Resolve");
+            return _connect();
+        }
     }
 
+    _mark();
+
     _resolver.async_resolve(
         _host.data(),
         std::to_string(_port).data(),
@@ -104,15 +231,35 @@ void SslClient::_onResolve(
     beast::error_code ec,
     asio::ip::tcp::resolver::results_type results)
 {
+    if(_cache) {
+        if(ec)
+            _cache->store(_host, _port, ec);
+        else
+            _cache->store(_host, _port, results);
+    }
+
     if(ec)
         return _processError(ec, "Resolve");
 
-    auto& layer = beast::get_lowest_layer(_stream);
+    _record(&ClientMetrics::resolve);
+
+    _endpoints.clear();
+    for(auto const& result: results)
+        _endpoints.push_back(result.endpoint());
+
+    _connect();
+}
+
+void SslClient::_connect()
+{
+    _mark();
+
+    auto& layer = beast::get_lowest_layer(*_stream);
     layer.expires_after(_timeout);
 
     // Make the connection on the IP address we get from a lookup
     layer.async_connect(
-        results,
+        _endpoints,
         beast::bind_front_handler(
             &SslClient::_onConnect,
             shared_from_this()));
@@ -124,11 +271,25 @@ void SslClient::_onConnect(
 {
     boost::ignore_unused(endpoint);
 
-    if(ec)
+    if(ec) {
+        // The cached addresses may be stale, resolve again on the next attempt
+        if(_cache)
+            _cache->invalidate(_host, _port);
         return _processError(ec, "Connect");
+    }
+
+    _record(&ClientMetrics::connect);
+
+    // Offer the session of a previous connection to skip the full handshake
+    if(_sessions) {
+        if(auto session = _sessions->get(_host, _port)) {
+            SSL_set_session(_stream->native_handle(), session);
+            SSL_SESSION_free(session);
+        }
+    }
 
     // Perform the SSL handshake
-    _stream.async_handshake(
+    _stream->async_handshake(
         asio::ssl::stream_base::client,
         beast::bind_front_handler(
             &SslClient::_onHandshake,
@@ -137,33 +298,167 @@ void SslClient::_onConnect(
 
 void SslClient::_onHandshake(beast::error_code ec)
 {
-    if(ec)
+    if(ec) {
+        if(_sessions)
+            _sessions->invalidate(_host, _port);
         return _processError(ec, "Handshake");
+    }
+
+    if(_sessions)
+        _sessions->countHandshake(SSL_session_reused(_stream->native_handle()));
+
+    _connected = true;
+    if(_metrics)
+        _metrics->connections.add();
+    _record(&ClientMetrics::handshake);
+
+    _buffer.consume(_buffer.size());
+    _buffer.reserve(_limits.bufferCapacity);
+
+    _write();
+}
 
-    auto& layer = beast::get_lowest_layer(_stream);
+void SslClient::_write()
+{
+    _mark();
+
+    if(_queue.front().source)
+        return _writeStream();
+
+    auto& layer = beast::get_lowest_layer(*_stream);
     layer.expires_after(_timeout);
 
     // Send the HTTP request to the remote host
     http::async_write(
-        _stream, _request,
+        *_stream, _request,
         beast::bind_front_handler(
             &SslClient::_onWrite,
             shared_from_this()));
 }
 
-void SslClient::_onWrite(beast::error_code ec, std::size_t bytes_transferred)
+void SslClient::_reconnect()
+{
+    _retried = true;
+    _close();
+    _resolve();
+}
+
+void SslClient::_close()
+{
+    if(!_connected)
+        return;
+
+    beast::error_code ec;
+    beast::get_lowest_layer(*_stream).socket().shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+    beast::get_lowest_layer(*_stream).close();
+    _connected = false;
+    if(_metrics)
+        _metrics->connections.sub();
+}
+
+void SslClient::_shutdown()
+{
+    _connected = false;
+    if(_metrics)
+        _metrics->connections.sub();
+
+    auto stream = std::move(_stream);
+
+    auto& layer = beast::get_lowest_layer(*stream);
+    layer.expires_after(_timeout);
+
+    // Gracefully close the stream, the next request gets a new one
+    stream->async_shutdown(
+        [stream](beast::error_code ec) {
+            if(ec && ec != asio::ssl::error::stream_errors::stream_truncated)
+                LOG(error) << "Shutdown: " << ec.message();
+        });
+}
+
+bool SslClient::_isAlive()
 {
-    boost::ignore_unused(bytes_transferred);
+    // Peek without blocking: would_block means the connection is idle and open,
+    // while eof or pending bytes (such as a close_notify alert) mean it is closing
+    auto& socket = beast::get_lowest_layer(*_stream).socket();
 
+    beast::error_code ec;
+    socket.non_blocking(true, ec);
     if(ec)
+        return false;
+
+    char c;
+    std::size_t n = socket.receive(asio::buffer(&c, 1), asio::socket_base::message_peek, ec);
+
+    return n == 0 && ec == asio::error::would_block;
+}
+
+bool SslClient::_canRetry(beast::error_code const& ec, bool written) const
+{
+    // A reused connection may have been closed by the server while idle,
+    // such a request is sent once more over a fresh connection
+    if(!_reused || _retried || _streamed)
+        return false;
+
+    // Once the request went out the server may have acted on it, only a request
+    // that is safe to repeat is sent again
+    if(written && !idempotent(_request.method()))
+        return false;
+
+    return ec == http::error::end_of_stream
+        || ec == asio::error::eof
+        || ec == asio::error::connection_reset
+        || ec == asio::error::connection_aborted
+        || ec == asio::error::broken_pipe
+        || ec == asio::ssl::error::stream_truncated;
+}
+
+void SslClient::_onWrite(beast::error_code ec, std::size_t bytes_transferred)
+{
+    if(_metrics)
+        _metrics->bytesSent.add(bytes_transferred);
+
+    if(ec) {
+        if(_canRetry(ec, false))
+            return _reconnect();
         return _processError(ec, "Write");
+    }
+
+    _record(&ClientMetrics::write);
+
+    if(_queue.front().sink)
+        return _readStream();
 
-    auto& layer = beast::get_lowest_layer(_stream);
+    auto& layer = beast::get_lowest_layer(*_stream);
     layer.expires_after(_timeout);
 
+    // The body is pre-sized from the Content-Length within the limit
+    _parser.emplace();
+    _parser->header_limit(_limits.headerSize);
+    _parser->body_limit(_limits.bodySize);
+
+    // The header comes first: the eager body read of beast misses an oversized Content-Length
+    http::async_read_header(
+        *_stream, _buffer, *_parser,
+        beast::bind_front_handler(
+            &SslClient::_onHeader,
+            shared_from_this()));
+}
+
+void SslClient::_onHeader(beast::error_code ec, std::size_t bytes_transferred)
+{
+    // Counted here, what the body read adds comes with its own completion
+    if(_metrics)
+        _metrics->bytesReceived.add(bytes_transferred);
+
+    if(!ec)
+        _record(&ClientMetrics::firstByte);
+
+    if(ec || _parser->is_done())
+        return _onRead(ec, 0);
+
     // Receive the HTTP response
     http::async_read(
-        _stream, _buffer, _response,
+        *_stream, _buffer, *_parser,
         beast::bind_front_handler(
             &SslClient::_onRead,
             shared_from_this()));
@@ -171,42 +466,199 @@ void SslClient::_onWrite(beast::error_code ec, std::size_t bytes_transferred)
 
 void SslClient::_onRead(beast::error_code ec, std::size_t bytes_transferred)
 {
-    boost::ignore_unused(bytes_transferred);
+    if(_metrics)
+        _metrics->bytesReceived.add(bytes_transferred);
 
-    if(ec)
+    if(ec) {
+        if(_canRetry(ec, true))
+            return _reconnect();
         return _processError(ec, "Read");
+    }
+
+    auto& response = _parser->get();
 
-    LOG(debug)
-        << _response.base()
-        << (_response.payload_size() < _payloadLimit
-            ? _response.body()
+    if(_decompression) {
+        auto value = response[http::field::content_encoding];
+        auto encoding = parseEncoding({value.data(), value.size()});
+        if(encoding != Encoding::identity) {
+            std::string body;
+            if(!decompress(response.body(), encoding, _limits.bodySize, body))
+                return _processError(beast::errc::make_error_code(beast::errc::bad_message), "Decompress");
+
+            response.body() = std::move(body);
+            response.erase(http::field::content_encoding);
+        }
+    }
+
+    LOG_MESSAGE
+        << response.base()
+        << (response.payload_size() < _payloadLimit
+            ? response.body()
             : "");
 
-    _condition.notify_all();
+    _finish(response.keep_alive());
+}
 
-    auto& layer = beast::get_lowest_layer(_stream);
-    layer.expires_after(_timeout);
+void SslClient::_finish(bool keepAlive)
+{
+    _record(&ClientMetrics::read);
+
+    // TLS 1.3 tickets arrive after the handshake, so the session is taken once data was read
+    if(_sessions && !_reused)
+        _sessions->store(_host, _port, SSL_get1_session(_stream->native_handle()));
+
+    // Keep the connection for the next request if the server allows it
+    if(!keepAlive)
+        _shutdown();
+    else
+        beast::get_lowest_layer(*_stream).expires_never();
+
+    _complete({});
+}
+
+void SslClient::_writeStream()
+{
+    // The header goes first, then the body as the source hands it out
+    _chunk.resize(_chunkSize);
+
+    _upload.emplace(_request.base());
+    _upload->body().data = nullptr;
+    _upload->body().more = true;
+    _serializer.emplace(*_upload);
+
+    beast::get_lowest_layer(*_stream).expires_after(_timeout);
+
+    http::async_write_header(
+        *_stream, *_serializer,
+        beast::bind_front_handler(
+            &SslClient::_onWriteChunk,
+            shared_from_this()));
+}
+
+void SslClient::_onWriteChunk(beast::error_code ec, std::size_t bytes_transferred)
+{
+    // The serializer asks for the next piece
+    if(ec == http::error::need_buffer)
+        ec = {};
+
+    if(ec || _serializer->is_done())
+        return _onWrite(ec, bytes_transferred);
+
+    if(_metrics)
+        _metrics->bytesSent.add(bytes_transferred);
+
+    _streamed = true;
 
-    // Gracefully close the stream
-    _stream.async_shutdown(
+    auto size = _queue.front().source(_chunk.data(), _chunk.size());
+
+    auto& body = _upload->body();
+    body.data = size ? _chunk.data() : nullptr;
+    body.size = size;
+    body.more = size > 0;
+
+    beast::get_lowest_layer(*_stream).expires_after(_timeout);
+
+    http::async_write(
+        *_stream, *_serializer,
         beast::bind_front_handler(
-            &SslClient::_onShutdown,
+            &SslClient::_onWriteChunk,
             shared_from_this()));
 }
 
-void SslClient::_onShutdown(beast::error_code ec)
+void SslClient::_readStream()
 {
-    if(ec && ec != asio::ssl::error::stream_errors::stream_truncated)
-        LOG(error) << "Shutdown: " << ec.message();
+    _chunk.resize(_chunkSize);
+
+    // Memory is bounded by the chunk size, not by the body
+    _download.emplace();
+    _download->header_limit(_limits.headerSize);
+    _download->body_limit(std::numeric_limits<std::uint64_t>::max());
+
+    beast::get_lowest_layer(*_stream).expires_after(_timeout);
+
+    http::async_read_header(
+        *_stream, _buffer, *_download,
+        beast::bind_front_handler(
+            &SslClient::_onReadChunk,
+            shared_from_this()));
+}
+
+void SslClient::_onReadChunk(beast::error_code ec, std::size_t bytes_transferred)
+{
+    // The chunk buffer is full
+    if(ec == http::error::need_buffer)
+        ec = {};
+
+    if(ec)
+        return _onRead(ec, bytes_transferred);
+
+    if(_metrics)
+        _metrics->bytesReceived.add(bytes_transferred);
+
+    auto& body = _download->get().body();
+    if(!body.data) {
+        // The header has just been read
+        _record(&ClientMetrics::firstByte);
+    }
+    else {
+        std::size_t size = _chunk.size() - body.size;
+        _streamed = true;
+
+        if(size && !_queue.front().sink({_chunk.data(), size})) {
+            LOG(warning) << "Read: aborted by the sink";
+            _close();
+            return _complete(asio::error::operation_aborted);
+        }
+    }
+
+    if(_download->is_done()) {
+        LOG_MESSAGE << _download->get().base();
+        return _finish(_download->get().keep_alive());
+    }
+
+    body.data = _chunk.data();
+    body.size = _chunk.size();
+
+    beast::get_lowest_layer(*_stream).expires_after(_timeout);
+
+    http::async_read(
+        *_stream, _buffer, *_download,
+        beast::bind_front_handler(
+            &SslClient::_onReadChunk,
+            shared_from_this()));
 }
 
 void SslClient::_processError(beast::error_code const& ec, std::string_view msg)
 {
-    std::this_thread::sleep_for(_errorTimeout);
+    if(_metrics)
+        _metrics->errors.add();
+
+    _close();
 
     LOG(error) << msg << ": " << ec.message();
-    _ec = ec;
-    _condition.notify_all();
+
+    // The caller learns of the failure a little later, the io thread goes on meanwhile
+    _errorTimer.expires_after(_errorTimeout);
+    _errorTimer.async_wait(
+        [self = shared_from_this(), ec](beast::error_code) {
+            self->_complete(ec);
+        });
+}
+
+void SslClient::_mark()
+{
+    if(_metrics)
+        _phase = metrics::Clock::now();
+}
+
+void SslClient::_record(Histogram ClientMetrics::* phase)
+{
+    if(!_metrics)
+        return;
+
+    auto now = metrics::Clock::now();
+    ((*_metrics).*phase).record(_phase, now);
+    _phase = now;
 }
 
 }
@@ -0,0 +1,58 @@
+#include "http/tls_session_cache.hpp"
+
+namespace http
+{
+
+SSL_SESSION* TlsSessionCache::get(std::string_view host, uint16_t port)
+{
+    auto key = _key(host, port);
+
+    std::scoped_lock lock(_mutex);
+
+    auto it = _sessions.find(key);
+    if(it == _sessions.end())
+        return nullptr;
+
+    SSL_SESSION_up_ref(it->second.get());
+    return it->second.get();
+}
+
+void TlsSessionCache::store(std::string_view host, uint16_t port, SSL_SESSION* session)
+{
+    SessionPtr ptr(session);
+    if(!ptr || !SSL_SESSION_is_resumable(ptr.get()))
+        return;
+
+    auto key = _key(host, port);
+
+    std::scoped_lock lock(_mutex);
+    _sessions[std::move(key)] = std::move(ptr);
+}
+
+void TlsSessionCache::invalidate(std::string_view host, uint16_t port)
+{
+    auto key = _key(host, port);
+
+    std::scoped_lock lock(_mutex);
+    _sessions.erase(key);
+}
+
+void TlsSessionCache::countHandshake(bool resumed)
+{
+    if(resumed)
+        ++_resumed;
+    else
+        ++_full;
+}
+
+TlsSessionCache::Stats TlsSessionCache::stats() const
+{
+    return {_full.load(), _resumed.load()};
+}
+
+std::string TlsSessionCache::_key(std::string_view host, uint16_t port)
+{
+    return std::string(host) + ":" + std::to_string(port);
+}
+
+}
@@ -0,0 +1,268 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "http/url.hpp"
+
+namespace http
+{
+
+namespace
+{
+
+// Characters passed through unescaped
+constexpr std::array<bool, 256> makeUnreserved()
+{
+    std::array<bool, 256> table{};
+    for(int c = '0'; c <= '9'; ++c)
+        table[c] = true;
+    for(int c = 'a'; c <= 'z'; ++c)
+        table[c] = true;
+    for(int c = 'A'; c <= 'Z'; ++c)
+        table[c] = true;
+    table['-'] = table['.'] = table['_'] = table['~'] = true;
+    return table;
+}
+
+constexpr auto unreserved = makeUnreserved();
+
+constexpr char hexDigits[] = "0123456789ABCDEF";
+
+int fromHex(char c)
+{
+    if(c >= '0' && c <= '9')
+        return c - '0';
+    if(c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Position of the first a or b from position on, the size when there is none.
+// Sixteen bytes are compared at a time where SSE2 is there
+std::size_t findEither(std::string_view text, std::size_t position, char a, char b)
+{
+    auto data = text.data();
+    auto size = text.size();
+
+#if defined(__SSE2__)
+    auto first = _mm_set1_epi8(a);
+    auto second = _mm_set1_epi8(b);
+    for(; position + 16 <= size; position += 16) {
+        auto block = _mm_loadu_si128(reinterpret_cast<__m128i const*>(data + position));
+        auto mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, first), _mm_cmpeq_epi8(block, second)));
+        if(mask)
+            return position + std::size_t(__builtin_ctz(unsigned(mask)));
+    }
+#endif
+
+    for(; position < size; ++position) {
+        if(data[position] == a || data[position] == b)
+            return position;
+    }
+    return size;
+}
+
+// Compares an encoded key with a plain one without decoding into memory
+bool equalDecoded(std::string_view encoded, std::string_view key)
+{
+    if(findEither(encoded, 0, '%', '+') == encoded.size())
+        return encoded == key;
+
+    std::size_t j = 0;
+    for(std::size_t i = 0; i < encoded.size(); ++i, ++j) {
+        char c = encoded[i];
+        if(c == '+') {
+            c = ' ';
+        }
+        else if(c == '%') {
+            if(i + 2 >= encoded.size())
+                return false;
+            int high = fromHex(encoded[i + 1]);
+            int low = fromHex(encoded[i + 2]);
+            if(high < 0 || low < 0)
+                return false;
+            c = char(high * 16 + low);
+            i += 2;
+        }
+        if(j == key.size() || key[j] != c)
+            return false;
+    }
+    return j == key.size();
+}
+
+}
+
+namespace url
+{
+
+void encode(std::string_view value, std::string& out)
+{
+    // Sized for the worst case once, trimmed to what was written
+    auto offset = out.size();
+    out.resize(offset + value.size() * 3);
+    char* p = out.data() + offset;
+
+    for(unsigned char c: value) {
+        if(unreserved[c]) {
+            *p++ = char(c);
+        }
+        else {
+            *p++ = '%';
+            *p++ = hexDigits[c >> 4];
+            *p++ = hexDigits[c & 15];
+        }
+    }
+
+    out.resize(std::size_t(p - out.data()));
+}
+
+bool decode(std::string_view value, std::string& out)
+{
+    auto offset = out.size();
+    out.resize(offset + value.size());
+    char* p = out.data() + offset;
+
+    // Runs without escapes are copied whole
+    std::size_t position = 0;
+    while(position < value.size()) {
+        auto next = findEither(value, position, '%', '+');
+        std::memcpy(p, value.data() + position, next - position);
+        p += next - position;
+        if(next == value.size())
+            break;
+
+        if(value[next] == '+') {
+            *p++ = ' ';
+            position = next + 1;
+            continue;
+        }
+
+        int high = next + 2 < value.size() ? fromHex(value[next + 1]) : -1;
+        int low = high >= 0 ? fromHex(value[next + 2]) : -1;
+        if(low < 0) {
+            out.resize(offset);
+            return false;
+        }
+        *p++ = char(high * 16 + low);
+        position = next + 3;
+    }
+
+    out.resize(std::size_t(p - out.data()));
+    return true;
+}
+
+std::string makeTarget(std::string_view path, ParamMap const& params)
+{
+    std::size_t size = path.size() + 1;
+    for(auto const& [key, value]: params)
+        size += (key.size() + value.size()) * 3 + 2;
+
+    std::string target;
+    target.reserve(size);
+    target += path;
+
+    char separator = '?';
+    for(auto const& [key, value]: params) {
+        target += separator;
+        encode(key, target);
+        target += '=';
+        encode(value, target);
+        separator = '&';
+    }
+
+    return target;
+}
+
+bool parseQuery(std::string_view target, ParamMap& params)
+{
+    bool valid = true;
+    std::string key;
+    Query(target).forEach([&](std::string_view rawKey, std::string_view rawValue) {
+        key.clear();
+        valid = decode(rawKey, key) && valid;
+        auto& value = params[key];
+        value.clear();
+        valid = decode(rawValue, value) && valid;
+    });
+    return valid;
+}
+
+}
+
+Query::Query(std::string_view target)
+{
+    auto position = target.find('?');
+    if(position != std::string_view::npos)
+        _query = target.substr(position + 1);
+
+    // A fragment is never sent, but is not a part of the query either
+    _query = _query.substr(0, _query.find('#'));
+}
+
+bool Query::_next(std::size_t& position, std::string_view& key, std::string_view& value) const
+{
+    while(position < _query.size()) {
+        // One scan finds both the end of the key and the end of the pair
+        auto split = findEither(_query, position, '=', '&');
+        auto end = split;
+        if(split < _query.size() && _query[split] == '=')
+            end = std::min(_query.find('&', split + 1), _query.size());
+
+        auto begin = position;
+        position = end + 1;
+
+        // Empty pairs from "&&" or a trailing '&' are skipped
+        if(end == begin)
+            continue;
+
+        key = _query.substr(begin, split - begin);
+        value = split < end ? _query.substr(split + 1, end - split - 1) : std::string_view();
+        return true;
+    }
+
+    return false;
+}
+
+bool Query::has(std::string_view key) const
+{
+    std::size_t position = 0;
+    std::string_view rawKey;
+    std::string_view rawValue;
+    while(_next(position, rawKey, rawValue)) {
+        if(equalDecoded(rawKey, key))
+            return true;
+    }
+    return false;
+}
+
+std::string_view Query::raw(std::string_view key) const
+{
+    std::size_t position = 0;
+    std::string_view rawKey;
+    std::string_view rawValue;
+    while(_next(position, rawKey, rawValue)) {
+        if(equalDecoded(rawKey, key))
+            return rawValue;
+    }
+    return {};
+}
+
+std::string_view Query::get(std::string_view key, std::string& buffer) const
+{
+    auto value = raw(key);
+    if(findEither(value, 0, '%', '+') == value.size())
+        return value;
+
+    buffer.clear();
+    if(!url::decode(value, buffer))
+        return {};
+    return buffer;
+}
+
+}
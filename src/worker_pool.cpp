@@ -0,0 +1,71 @@
+#include <loguru.hpp>
+
+#include "http/worker_pool.hpp"
+
+namespace http
+{
+
+WorkerPool::WorkerPool(std::size_t threads, std::size_t queueLimit)
+    : _queueLimit(queueLimit)
+{
+    for(std::size_t i = 0; i < std::max<std::size_t>(threads, 1); ++i)
+        _threads.emplace_back(std::thread([this]() { _run(); }));
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::scoped_lock lock(_mutex);
+        _stop = true;
+    }
+    _condition.notify_all();
+
+    for(auto& t: _threads)
+        t.join();
+}
+
+bool WorkerPool::post(TaskType task)
+{
+    {
+        std::scoped_lock lock(_mutex);
+        if(_stop || _tasks.size() >= _queueLimit)
+            return false;
+
+        _tasks.push_back(std::move(task));
+    }
+    _condition.notify_one();
+
+    return true;
+}
+
+std::size_t WorkerPool::queued() const
+{
+    std::scoped_lock lock(_mutex);
+    return _tasks.size();
+}
+
+void WorkerPool::_run()
+{
+    while(true) {
+        TaskType task;
+        {
+            std::unique_lock lock(_mutex);
+            _condition.wait(lock, [this]() { return _stop || !_tasks.empty(); });
+
+            if(_tasks.empty())
+                return;
+
+            task = std::move(_tasks.front());
+            _tasks.pop_front();
+        }
+
+        try {
+            task();
+        }
+        catch(std::exception const& e) {
+            LOG(error) << "Worker task: " << e.what();
+        }
+    }
+}
+
+}